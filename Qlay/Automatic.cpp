@@ -0,0 +1,365 @@
+/**
+ * @file Automatic.cpp
+ *
+ * Implements automatic backend selection.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Automatic.h"
+#include "StateVector.h"
+#include "Stabilizer.h"
+#include "SparseState.h"
+#include "MatrixProductState.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace qlay
+{
+	namespace
+	{
+		//Most qubits held in a state vector, whose 2^30 amplitudes take 16 GiB
+		constexpr int MAX_DENSE_QUBITS = 30;
+
+		//Below this many qubits a state vector is cheap whatever the support of the state
+		constexpr int MIN_SPARSE_QUBITS = 20;
+
+		//Most nonzero amplitudes, as a power of two, held sparsely beyond MAX_DENSE_QUBITS
+		constexpr int MAX_SPARSE_BITS = 24;
+
+		//Most operations recorded for replay, about 40 MiB of history
+		constexpr std::size_t MAX_HISTORY = std::size_t(1) << 18;
+
+		bool is_diagonal(const Mat &m)
+		{
+			return m.isDiagonal();
+		}
+	}
+
+	AutomaticState::AutomaticState() : inner_(std::make_unique<Stabilizer>())
+	{
+	}
+
+	void AutomaticState::record(Record r)
+	{
+		if (!replayable_)
+			return;
+
+		if (history_.size() == MAX_HISTORY)
+		{
+			history_ = std::vector<Record>();
+			replayable_ = false;
+			return;
+		}
+
+		history_.push_back(std::move(r));
+	}
+
+	std::unique_ptr<MatrixProductState> AutomaticState::replay() const
+	{
+		if (!replayable_)
+			return nullptr;
+
+		//Qubits added part way through start in |0>, so may as well be added first
+		auto mps = std::make_unique<MatrixProductState>();
+		mps->set_truncation(truncation_);
+		for (int q = 0; q < count_; q++)
+			mps->add_qubit();
+
+		for (const Record &r : history_)
+		{
+			if (r.m.size() == 0)
+			{
+				//Collapsing one qubit at a time leaves the same state
+				for (std::size_t j = 0; j < r.indices.size(); j++)
+				{
+					const int q = r.indices[j];
+					const bool bit = (r.outcome >> j) & 1;
+					const double p = mps->probability(q);
+					mps->collapse({ q }, bit, bit ? p : 1 - p);
+				}
+			}
+			else if (r.b < 0)
+				mps->apply(r.m, r.a);
+			else
+			{
+				//A bond at the limit may already have been truncated, so the replay is inexact
+				mps->apply(r.m, r.a, r.b);
+				if (mps->largest_bond() >= truncation_.max_bond)
+					return nullptr;
+			}
+		}
+
+		return mps;
+	}
+
+	void AutomaticState::convert(const std::string &reason, bool diagonal)
+	{
+		const Stabilizer &tableau = static_cast<const Stabilizer &>(*inner_);
+		const std::string qubits = std::to_string(count_) + " qubits";
+
+		//Diagonal gates never spread the amplitudes, and others at most double them, so a
+		//sparse state pays while it would fill under a quarter or a sixteenth of a state vector
+		const int sparse_bits = count_ <= MAX_DENSE_QUBITS ? count_ - (diagonal ? 2 : 4) : MAX_SPARSE_BITS;
+		const int support = count_ >= MIN_SPARSE_QUBITS && count_ <= 63 ? tableau.support_bits() : -1;
+		const bool sparse = support >= 0 && support <= sparse_bits;
+
+		if (sparse)
+		{
+			inner_ = std::make_unique<SparseState>(tableau.to_map(), count_);
+			active_ = Backend::Sparse;
+			reason_ = reason + "; the state of " + qubits + " has only 2^" + std::to_string(support)
+				+ " nonzero amplitudes" + (diagonal ? ", which diagonal gates keep" : "");
+		}
+		else if (count_ <= MAX_DENSE_QUBITS)
+		{
+			inner_ = std::make_unique<StateVector>(tableau.to_ket(), count_);
+			active_ = Backend::StateVector;
+			reason_ = reason + "; " + qubits + " fit a state vector";
+		}
+		else
+		{
+			//Replay only should the final bonds fit, though those along the way may not
+			const int entanglement = tableau.entanglement_bits();
+			std::unique_ptr<MatrixProductState> mps;
+			if (entanglement < 31 && (1 << entanglement) < truncation_.max_bond)
+				mps = replay();
+
+			//Bonds short of the entanglement mean the replay lost precision
+			if (mps && mps->largest_bond() < (1 << entanglement))
+				mps = nullptr;
+
+			if (!mps)
+				throw std::length_error("Automatic backend cannot hold " + qubits + " with too many nonzero amplitudes"
+					" and bonds beyond " + std::to_string(truncation_.max_bond) + "; choose a backend explicitly");
+
+			inner_ = std::move(mps);
+			active_ = Backend::MatrixProduct;
+			reason_ = reason + "; " + qubits + " exceed a state vector, but their entanglement needs bonds of only 2^"
+				+ std::to_string(entanglement);
+		}
+
+		history_ = std::vector<Record>();
+	}
+
+	template <typename Op>
+	void AutomaticState::dispatch(Op op, const char *reason, bool diagonal)
+	{
+		if (active_ == Backend::Stabilizer)
+		{
+			//Backends reject unsupported operations before modifying any state, and a
+			//conversion which fails leaves the tableau as it was
+			try
+			{
+				op(*inner_);
+				return;
+			}
+			catch (const std::domain_error &)
+			{
+				convert(reason, diagonal);
+			}
+		}
+
+		op(*inner_);
+	}
+
+	void AutomaticState::add_qubit()
+	{
+		//A state vector at the largest size allowed continues as a sparse state, should
+		//few of its amplitudes be nonzero
+		if (active_ == Backend::StateVector && count_ >= MAX_DENSE_QUBITS)
+		{
+			const StateVector &v = static_cast<const StateVector &>(*inner_);
+			const std::size_t limit = std::size_t(1) << MAX_SPARSE_BITS;
+
+			AmplitudeMap map;
+			for (Eigen::Index i = 0; i < v.size(); i++)
+				if (v.amplitude(i) != Complex(0))
+				{
+					if (map.size() == limit)
+						throw std::length_error("Automatic backend cannot add a qubit to a state vector of "
+							+ std::to_string(count_) + " qubits with over 2^" + std::to_string(MAX_SPARSE_BITS)
+							+ " nonzero amplitudes; choose a backend explicitly");
+
+					map.add(static_cast<Bitstring>(i), v.amplitude(i));
+				}
+
+			inner_ = std::make_unique<SparseState>(std::move(map), count_);
+			active_ = Backend::Sparse;
+			reason_ += "; qubits added beyond a state vector, but few amplitudes are nonzero";
+		}
+
+		inner_->add_qubit();
+		count_++;
+	}
+
+	void AutomaticState::reset()
+	{
+		//Keep the current backend, as a reset system usually reruns the same circuit
+		inner_->reset();
+		history_.clear();
+		replayable_ = true;
+	}
+
+	void AutomaticState::set_truncation(const Truncation &truncation)
+	{
+		inner_->set_truncation(truncation);
+		truncation_ = truncation;
+	}
+
+	void AutomaticState::apply(const Mat &m, int q)
+	{
+		dispatch([&](State &s) { s.apply(m, q); }, "Non-Clifford gate applied", is_diagonal(m));
+
+		if (active_ == Backend::Stabilizer)
+			record({ m, q, -1, {}, 0 });
+	}
+
+	void AutomaticState::apply(const Mat &m, int a, int b)
+	{
+		dispatch([&](State &s) { s.apply(m, a, b); }, "Non-Clifford gate applied", is_diagonal(m));
+
+		if (active_ == Backend::Stabilizer)
+			record({ m, a, b, {}, 0 });
+	}
+
+	void AutomaticState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		const bool diagonal = std::all_of(kraus.begin(), kraus.end(), is_diagonal);
+		dispatch([&](State &s) { s.apply_channel(kraus, q); }, "Non-Pauli noise channel applied", diagonal);
+
+		//The tableau picks one of the Paulis without saying which, so the history is lost
+		if (active_ == Backend::Stabilizer)
+		{
+			history_ = std::vector<Record>();
+			replayable_ = false;
+		}
+	}
+
+	void AutomaticState::apply_pauli_channel(double px, double py, double pz, int q)
+	{
+		//On the tableau the chosen Pauli is applied through this state, so it is recorded
+		if (active_ == Backend::Stabilizer)
+			State::apply_pauli_channel(px, py, pz, q);
+		else
+			inner_->apply_pauli_channel(px, py, pz, q);
+	}
+
+	double AutomaticState::probability(int q) const
+	{
+		return inner_->probability(q);
+	}
+
+	double AutomaticState::probability(Bitstring outcome) const
+	{
+		return inner_->probability(outcome);
+	}
+
+	std::vector<double> AutomaticState::marginal(const std::vector<int> &indices) const
+	{
+		return inner_->marginal(indices);
+	}
+
+	void AutomaticState::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		inner_->collapse(indices, outcome, p);
+
+		if (active_ == Backend::Stabilizer)
+			record({ Mat(), 0, -1, indices, outcome });
+	}
+
+	Bitstring AutomaticState::measure(const std::vector<int> &indices)
+	{
+		Bitstring outcome = inner_->measure(indices);
+
+		if (active_ == Backend::Stabilizer)
+			record({ Mat(), 0, -1, indices, outcome });
+
+		return outcome;
+	}
+
+	std::vector<Bitstring> AutomaticState::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		return inner_->sample(shots, indices);
+	}
+
+	double AutomaticState::expectation(const PauliString &p) const
+	{
+		return inner_->expectation(p);
+	}
+
+	void AutomaticState::print(std::ostream &os, int count) const
+	{
+		inner_->print(os, count);
+	}
+
+	BackendReport AutomaticState::report() const
+	{
+		BackendReport r = inner_->report();
+		r.reason = reason_;
+		return r;
+	}
+
+	std::unique_ptr<State> AutomaticState::fork() const
+	{
+		auto f = std::make_unique<AutomaticState>();
+		f->inner_ = inner_->fork();
+		f->active_ = active_;
+		f->reason_ = reason_;
+		f->truncation_ = truncation_;
+		f->count_ = count_;
+		f->history_ = history_;
+		f->replayable_ = replayable_;
+
+		return f;
+	}
+
+	void AutomaticState::save(std::ostream &os) const
+	{
+		inner_->save(os);
+	}
+
+	void AutomaticState::load(const Complex *v, int count, const std::vector<int> &layout)
+	{
+		//Nothing is known of the gates which prepared the state, so assume it needs a state
+		//vector, unless that would be too large and few amplitudes are nonzero
+		if (count <= MAX_DENSE_QUBITS)
+		{
+			inner_ = std::make_unique<StateVector>();
+			inner_->set_truncation(truncation_);
+			inner_->load(v, count, layout);
+
+			active_ = Backend::StateVector;
+			reason_ = "Loaded from a checkpoint";
+		}
+		else
+		{
+			const Bitstring size = Bitstring(1) << count;
+			const std::size_t limit = std::size_t(1) << MAX_SPARSE_BITS;
+
+			//Bit layout[q] of each stored index holds qubit q
+			AmplitudeMap map;
+			for (Bitstring i = 0; i < size; i++)
+				if (v[i] != Complex(0))
+				{
+					if (map.size() == limit)
+						throw std::length_error("Automatic backend cannot load a checkpoint of " + std::to_string(count)
+							+ " qubits with over 2^" + std::to_string(MAX_SPARSE_BITS)
+							+ " nonzero amplitudes; choose a backend explicitly");
+
+					map.add(gather_bits(static_cast<Eigen::Index>(i), layout), v[i]);
+				}
+
+			inner_ = std::make_unique<SparseState>(std::move(map), count);
+			inner_->set_truncation(truncation_);
+
+			active_ = Backend::Sparse;
+			reason_ = "Loaded from a checkpoint of " + std::to_string(count) + " qubits, too many for a state vector,"
+				" but with few nonzero amplitudes";
+		}
+
+		count_ = count;
+		history_ = std::vector<Record>();
+	}
+}
@@ -0,0 +1,90 @@
+/**
+ * @file Automatic.h
+ *
+ * Internal header defining automatic backend selection.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+namespace qlay
+{
+	class MatrixProductState;
+
+	//Wraps whichever backend suits the gates applied so far. Systems start on
+	//the stabilizer tableau, which handles Clifford circuits in polynomial time,
+	//and convert the first time a gate or channel needs amplitudes: to a state
+	//vector while one fits in memory, otherwise to a sparse state should few basis
+	//states have nonzero amplitude, or else to a matrix product state by replaying
+	//the operations applied to the tableau, should the entanglement stay low.
+	class AutomaticState : public State
+	{
+	private:
+		//Operation applied to the tableau: the operator m on qubit a (and b), or
+		//should m be empty, a collapse of the given qubits onto the outcome
+		struct Record
+		{
+			Mat m;
+			int a = 0;
+			int b = -1;
+			std::vector<int> indices;
+			Bitstring outcome = 0;
+		};
+
+		std::unique_ptr<State> inner_;
+		Backend active_ = Backend::Stabilizer;
+		std::string reason_ = "Only Clifford gates applied";
+		Truncation truncation_;
+		int count_ = 0;
+
+		//Operations applied since the tableau was last reset, while they are known
+		std::vector<Record> history_;
+		bool replayable_ = true;
+
+		//Appends to the history, abandoning it once too long
+		void record(Record r);
+
+		//Returns a matrix product state replaying the history, or null should a bond
+		//reach the largest dimension allowed
+		std::unique_ptr<MatrixProductState> replay() const;
+
+		//Converts the tableau to the backend best suited to its size and support,
+		//recording why, or throws std::length_error should none fit
+		void convert(const std::string &reason, bool diagonal);
+
+		//Runs op on the inner backend, converting it should the operation be
+		//unsupported. Diagonal operations leave the support of the state unchanged.
+		template <typename Op>
+		void dispatch(Op op, const char *reason, bool diagonal);
+
+	public:
+		AutomaticState();
+
+		void add_qubit() override;
+		void reset() override;
+		void set_truncation(const Truncation &truncation) override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+		void apply_pauli_channel(double px, double py, double pz, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+
+		void save(std::ostream &os) const override;
+		void load(const Complex *v, int count, const std::vector<int> &layout) override;
+	};
+}
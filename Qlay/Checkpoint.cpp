@@ -0,0 +1,172 @@
+/**
+ * @file Checkpoint.cpp
+ *
+ * Implements saving and loading QubitSystems to and from binary files.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Core.h"
+#include "MappedFile.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+
+namespace qlay
+{
+	namespace
+	{
+		const char MAGIC[8] = { 'Q', 'L', 'A', 'Y', 'S', 'A', 'V', 'E' };
+
+		//Incremented whenever the layout of the file changes
+		constexpr std::uint32_t VERSION = 1;
+
+		//The amplitudes start on a boundary suitable for mapping them directly on any system
+		constexpr std::uint64_t ALIGNMENT = 1 << 16;
+
+		//Most qubits whose amplitudes' size in bytes fits in 64 bits
+		constexpr int MAX_QUBITS = 59;
+
+		//Start of every file, in native byte order. The generator state and the bit
+		//holding each qubit follow, then the amplitudes at an aligned offset.
+		struct Header
+		{
+			char magic[8];
+			std::uint32_t version;
+			std::uint32_t backend;          //Backend the system was saved from
+			std::uint32_t count;            //Number of qubits
+			std::uint32_t complex_size;     //Bytes per amplitude
+			std::uint64_t rng_offset;
+			std::uint64_t rng_size;
+			std::uint64_t layout_offset;    //32-bit bit index per qubit
+			std::uint64_t amplitudes_offset;
+			std::uint64_t amplitudes_size;
+		};
+
+		static_assert(sizeof(Header) == 64, "Header must have no padding");
+		static_assert(std::is_trivially_copyable<Philox>::value, "Philox is saved byte for byte");
+	}
+
+	void State::save(std::ostream &) const
+	{
+		throw std::domain_error("Backend does not hold amplitudes to save");
+	}
+
+	void State::load(const Complex *, int, const std::vector<int> &)
+	{
+		throw std::domain_error("Backend cannot load amplitudes");
+	}
+
+	void QubitSystem::save(const std::string &path) const
+	{
+		if (count_ > MAX_QUBITS)
+			throw std::length_error("Systems of more than 59 qubits cannot be saved");
+
+		std::vector<int> layout = state_->layout();
+		if (layout.empty())
+		{
+			layout.resize(count_);
+			std::iota(layout.begin(), layout.end(), 0);
+		}
+
+		std::vector<std::int32_t> bits(layout.begin(), layout.end());
+
+		Header h = {};
+		std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+		h.version = VERSION;
+		h.backend = static_cast<std::uint32_t>(backend_);
+		h.count = static_cast<std::uint32_t>(count_);
+		h.complex_size = sizeof(Complex);
+		h.rng_offset = sizeof(Header);
+		h.rng_size = sizeof(Philox);
+		h.layout_offset = h.rng_offset + h.rng_size;
+		h.amplitudes_offset = (h.layout_offset + bits.size() * sizeof(std::int32_t) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		h.amplitudes_size = count_ ? (std::uint64_t(1) << count_) * sizeof(Complex) : 0;
+
+		std::ofstream os(path, std::ios::binary | std::ios::trunc);
+		if (!os)
+			throw std::runtime_error("Could not create " + path);
+
+		try
+		{
+			os.write(reinterpret_cast<const char *>(&h), sizeof(h));
+			os.write(reinterpret_cast<const char *>(&rng), sizeof(Philox));
+			os.write(reinterpret_cast<const char *>(bits.data()), bits.size() * sizeof(std::int32_t));
+
+			std::string padding(static_cast<std::size_t>(h.amplitudes_offset - os.tellp()), '\0');
+			os.write(padding.data(), padding.size());
+
+			state_->save(os);
+
+			if (!os.flush())
+				throw std::runtime_error("Could not write " + path);
+		}
+		catch (...)
+		{
+			//Leave no partial file behind
+			os.close();
+			std::filesystem::remove(path);
+			throw;
+		}
+	}
+
+	void QubitSystem::load(const std::string &path)
+	{
+		MappedFile file = MappedFile::open(path);
+		const char *data = static_cast<const char *>(file.data());
+
+		Header h;
+		if (file.size() < sizeof(Header))
+			throw std::runtime_error(path + " is not a Qlay checkpoint");
+
+		std::memcpy(&h, data, sizeof(Header));
+		if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+			throw std::runtime_error(path + " is not a Qlay checkpoint");
+		if (h.version != VERSION)
+			throw std::runtime_error(path + " was saved by an unsupported version of Qlay");
+
+		//Check every section lies within the file before reading any of it, in a form
+		//that cannot overflow whatever the header holds
+		const std::uint64_t size = file.size();
+		auto within = [size](std::uint64_t offset, std::uint64_t length) { return offset <= size && length <= size - offset; };
+
+		if (h.count > MAX_QUBITS)
+			throw std::runtime_error(path + " is corrupt or from another platform");
+
+		const std::uint64_t expected = h.count ? (std::uint64_t(1) << h.count) * sizeof(Complex) : 0;
+		if (h.complex_size != sizeof(Complex) || h.rng_size != sizeof(Philox)
+			|| h.amplitudes_size != expected || h.amplitudes_offset % ALIGNMENT != 0
+			|| !within(h.rng_offset, h.rng_size)
+			|| !within(h.layout_offset, h.count * sizeof(std::int32_t))
+			|| !within(h.amplitudes_offset, h.amplitudes_size))
+			throw std::runtime_error(path + " is corrupt or from another platform");
+
+		const int count = static_cast<int>(h.count);
+		//Every qubit must be held by a distinct bit
+		std::vector<int> layout(count);
+		std::vector<bool> held(count, false);
+		for (int q = 0; q < count; q++)
+		{
+			std::int32_t bit;
+			std::memcpy(&bit, data + h.layout_offset + q * sizeof(std::int32_t), sizeof(bit));
+			if (bit < 0 || bit >= count || held[bit])
+				throw std::runtime_error(path + " is corrupt or from another platform");
+
+			layout[q] = bit;
+			held[bit] = true;
+		}
+
+		//The amplitudes are read in place from the mapping, into whichever backend this system uses
+		std::shared_ptr<State> state = make_state(backend_);
+		state->set_truncation(truncation_);
+		state->load(reinterpret_cast<const Complex *>(data + h.amplitudes_offset), count, layout);
+
+		state_ = std::move(state);
+		count_ = count;
+		std::memcpy(static_cast<void *>(&rng), data + h.rng_offset, sizeof(Philox));
+	}
+}
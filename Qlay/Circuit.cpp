@@ -0,0 +1,526 @@
+/**
+ * @file Circuit.cpp
+ *
+ * Implements recording circuits and running their execution plans.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Circuit.h"
+
+#include <cmath>
+#include <limits>
+#include <set>
+#include <stdexcept>
+
+namespace qlay
+{
+	namespace
+	{
+		//Returns the given two-qubit operator with its inputs exchanged
+		Mat exchanged(const Mat &m)
+		{
+			const int order[4] = { 0, 2, 1, 3 };
+
+			Mat e(4, 4);
+			for (int i = 0; i < 4; i++)
+				for (int j = 0; j < 4; j++)
+					e(i, j) = m(order[i], order[j]);
+
+			return e;
+		}
+
+		//Angles within this of a full period leave a rotation the identity
+		constexpr double ANGLE_TOLERANCE = 1e-12;
+
+		bool is_rotation(Op op)
+		{
+			return op == Op::Rx || op == Op::Ry || op == Op::Rz || op == Op::Rp;
+		}
+
+		//Returns whether the rotation by the given angle is exactly the identity, not just
+		//up to global phase; Rx, Ry and Rz have a period of 4 pi, Rp of 2 pi
+		bool is_identity(Op op, double angle)
+		{
+			double period = op == Op::Rp ? 2 * PI : 4 * PI;
+			double r = std::fmod(std::abs(angle), period);
+			return r < ANGLE_TOLERANCE || period - r < ANGLE_TOLERANCE;
+		}
+
+		//How an operation acts on one of its qubits. Diagonal operators commute with one
+		//another, as do X and Rx, so operations acting on every qubit they share in the same
+		//role (other than Other) commute; a CNOT is diagonal on its control and X on its target.
+		enum class Role { Diagonal, Flip, Other };
+
+		Role role(const Operation &op, int q)
+		{
+			switch (op.op)
+			{
+			case Op::Z: case Op::Rz: case Op::Rp:
+				return Role::Diagonal;
+			case Op::X: case Op::Rx:
+				return Role::Flip;
+			case Op::CNOT:
+				return q == op.a ? Role::Diagonal : Role::Flip;
+			default:
+				return Role::Other;
+			}
+		}
+
+		//Returns whether the two operations may be exchanged
+		bool commutes(const Operation &x, const Operation &y)
+		{
+			for (int q : { y.a, y.b })
+			{
+				if (q < 0 || (q != x.a && q != x.b))
+					continue;
+
+				Role r = role(x, q);
+				if (r == Role::Other || r != role(y, q))
+					return false;
+			}
+
+			return true;
+		}
+
+		//Returns whether the operation acts only on qubits the other acts on
+		bool within(const Operation &x, const Operation &y)
+		{
+			return (x.a == y.a || x.a == y.b) && (x.b < 0 || x.b == y.a || x.b == y.b);
+		}
+
+		//Returns whether applying y straight after x leaves the state unchanged
+		bool cancels(const Operation &x, const Operation &y)
+		{
+			if (x.op != y.op)
+				return false;
+
+			switch (x.op)
+			{
+			case Op::X: case Op::Y: case Op::Z: case Op::H:
+				return x.a == y.a;
+			case Op::CNOT:
+				return x.a == y.a && x.b == y.b;
+			case Op::SWAP:
+				return (x.a == y.a && x.b == y.b) || (x.a == y.b && x.b == y.a);
+			default:
+				return false;
+			}
+		}
+	}
+
+	void Program::record(Operation op)
+	{
+		if (op.a < 0 || op.b < -1 || op.a == op.b)
+			throw std::out_of_range("Circuit qubit indices must be distinct and nonnegative");
+		if (op.op == Op::M && measurements == std::numeric_limits<Bitstring>::digits)
+			throw std::length_error("Circuit results hold at most 64 measurements");
+
+		count = std::max({ count, op.a + 1, op.b + 1 });
+		if (op.op == Op::M)
+			measurements++;
+
+		operations.push_back(std::move(op));
+		compiled = false;
+	}
+
+	OptimisationReport Program::optimise()
+	{
+		OptimisationReport report;
+		std::vector<bool> removed(operations.size(), false);
+
+		for (std::size_t i = 0; i < operations.size(); i++)
+		{
+			Operation &op = operations[i];
+			if (op.op == Op::M)
+				continue;
+
+			report.before++;
+
+			if (is_rotation(op.op) && is_identity(op.op, op.angle))
+			{
+				removed[i] = true;
+				report.cancelled++;
+				continue;
+			}
+
+			//Look back past every operation this one commutes with for one to combine with
+			for (std::size_t j = i; j-- > 0;)
+			{
+				if (removed[j])
+					continue;
+
+				Operation &prior = operations[j];
+				if (cancels(prior, op))
+				{
+					removed[i] = removed[j] = true;
+					report.cancelled += 2;
+				}
+				else if (is_rotation(op.op) && prior.op == op.op && prior.a == op.a)
+				{
+					prior.angle += op.angle;
+					prior.m = rotation(prior.op, prior.angle);
+					removed[i] = true;
+					report.merged++;
+
+					if (is_identity(prior.op, prior.angle))
+					{
+						removed[j] = true;
+						report.cancelled++;
+					}
+				}
+				else if (commutes(prior, op))
+					continue;
+
+				break;
+			}
+		}
+
+		std::vector<Operation> kept;
+		for (std::size_t i = 0; i < operations.size(); i++)
+			if (!removed[i])
+				kept.push_back(std::move(operations[i]));
+
+		operations = std::move(kept);
+		report.after = report.before - report.cancelled - report.merged;
+		compiled = false;
+
+		return report;
+	}
+
+	std::vector<Operation> Program::schedule() const
+	{
+		const int n = static_cast<int>(operations.size());
+		std::vector<std::vector<int>> successors(n);
+		std::vector<int> pending(n, 0); //Predecessors not yet scheduled
+
+		//On each qubit, operations form runs acting in the same role, so each need only
+		//follow the run before its own. Measurements also stay in order, as they number
+		//the bits of the result.
+		struct Runs
+		{
+			Role role = Role::Other;
+			std::vector<int> current;
+			std::vector<int> previous;
+		};
+
+		std::vector<Runs> runs(count);
+		int last_measurement = -1;
+
+		for (int i = 0; i < n; i++)
+		{
+			const Operation &op = operations[i];
+			for (int q : { op.a, op.b })
+			{
+				if (q < 0)
+					continue;
+
+				Runs &r = runs[q];
+				Role role_q = role(op, q);
+				if (!r.current.empty() && role_q == r.role && role_q != Role::Other)
+				{
+					for (int j : r.previous)
+					{
+						successors[j].push_back(i);
+						pending[i]++;
+					}
+
+					r.current.push_back(i);
+				}
+				else
+				{
+					for (int j : r.current)
+					{
+						successors[j].push_back(i);
+						pending[i]++;
+					}
+
+					r.previous = std::move(r.current);
+					r.current = { i };
+					r.role = role_q;
+				}
+			}
+
+			if (op.op == Op::M)
+			{
+				if (last_measurement >= 0)
+				{
+					successors[last_measurement].push_back(i);
+					pending[i]++;
+				}
+
+				last_measurement = i;
+			}
+		}
+
+		//Ready operations, by their highest qubit then their recorded position
+		std::set<std::pair<int, int>> ready;
+		std::vector<std::set<int>> ready_on(count);
+
+		auto make_ready = [&](int i)
+		{
+			const Operation &op = operations[i];
+			ready.insert({ std::max(op.a, op.b), i });
+			ready_on[op.a].insert(i);
+			if (op.b >= 0)
+				ready_on[op.b].insert(i);
+		};
+
+		for (int i = 0; i < n; i++)
+			if (pending[i] == 0)
+				make_ready(i);
+
+		std::vector<Operation> order;
+		order.reserve(n);
+		int last = -1;
+
+		while (!ready.empty())
+		{
+			//Prefer an operation on only the qubits of the last, to be fused with it, otherwise
+			//the one with the lowest highest qubit, keeping runs within the low-order qubits
+			//(and so within a block of the state) together
+			int next = -1;
+			if (last >= 0)
+			{
+				const Operation &prior = operations[last];
+				for (int q : { prior.a, prior.b })
+				{
+					if (q < 0)
+						continue;
+
+					for (int i : ready_on[q])
+					{
+						if (within(operations[i], prior))
+						{
+							if (next < 0 || i < next)
+								next = i;
+							break;
+						}
+					}
+				}
+			}
+
+			if (next < 0)
+				next = ready.begin()->second;
+
+			const Operation &op = operations[next];
+			ready.erase({ std::max(op.a, op.b), next });
+			ready_on[op.a].erase(next);
+			if (op.b >= 0)
+				ready_on[op.b].erase(next);
+
+			order.push_back(op);
+			for (int s : successors[next])
+				if (--pending[s] == 0)
+					make_ready(s);
+
+			last = next;
+		}
+
+		return order;
+	}
+
+	void Program::lower()
+	{
+		const Mat I = Mat::Identity(2, 2);
+
+		plan.clear();
+		std::vector<bool> absorbed;
+		std::vector<int> last(count, -1); //Step which last acted on each qubit
+		int bit = 0;
+
+		//Every step a gate joins is the last to act on its qubits, so moving the gate
+		//there passes over only steps acting on other qubits
+		for (const Operation &op : schedule())
+		{
+			if (op.op == Op::M)
+			{
+				std::vector<int> *measured = !plan.empty() && plan.back().is_measurement() ? &plan.back().measured : nullptr;
+				if (measured && std::find(measured->begin(), measured->end(), op.a) == measured->end())
+					measured->push_back(op.a);
+				else
+				{
+					Step s;
+					s.measured = { op.a };
+					s.bit = bit;
+					plan.push_back(std::move(s));
+					absorbed.push_back(false);
+				}
+
+				last[op.a] = static_cast<int>(plan.size()) - 1;
+				bit++;
+			}
+			else if (op.b < 0)
+			{
+				int k = last[op.a];
+				if (k >= 0 && !plan[k].is_measurement())
+				{
+					Step &s = plan[k];
+					if (s.b < 0)
+						s.m = op.m * s.m;
+					else
+						s.m = (s.a == op.a ? kronecker_product(op.m, I) : kronecker_product(I, op.m)) * s.m;
+				}
+				else
+				{
+					Step s;
+					s.m = op.m;
+					s.a = op.a;
+					plan.push_back(std::move(s));
+					absorbed.push_back(false);
+					last[op.a] = static_cast<int>(plan.size()) - 1;
+				}
+			}
+			else
+			{
+				int ka = last[op.a];
+				int kb = last[op.b];
+
+				//Consecutive gates on the same pair multiply into one
+				if (ka >= 0 && ka == kb && !plan[ka].is_measurement())
+				{
+					Step &s = plan[ka];
+					s.m = op.m * (s.a == op.a ? s.m : exchanged(s.m));
+					s.a = op.a;
+					s.b = op.b;
+					continue;
+				}
+
+				//Single-qubit steps last to act on either qubit are absorbed
+				Mat m = op.m;
+				if (ka >= 0 && !plan[ka].is_measurement() && plan[ka].b < 0)
+				{
+					m = m * kronecker_product(plan[ka].m, I);
+					absorbed[ka] = true;
+				}
+				if (kb >= 0 && !plan[kb].is_measurement() && plan[kb].b < 0)
+				{
+					m = m * kronecker_product(I, plan[kb].m);
+					absorbed[kb] = true;
+				}
+
+				Step s;
+				s.m = std::move(m);
+				s.a = op.a;
+				s.b = op.b;
+				plan.push_back(std::move(s));
+				absorbed.push_back(false);
+				last[op.a] = last[op.b] = static_cast<int>(plan.size()) - 1;
+			}
+		}
+
+		std::vector<Step> kept;
+		for (std::size_t i = 0; i < plan.size(); i++)
+			if (!absorbed[i])
+				kept.push_back(std::move(plan[i]));
+
+		plan = std::move(kept);
+		compiled = true;
+	}
+
+	Circuit::Circuit() : program_(std::make_shared<Program>())
+	{
+	}
+
+	Circuit::Circuit(const Circuit &other) : program_(std::make_shared<Program>(*other.program_))
+	{
+	}
+
+	Circuit &Circuit::operator=(const Circuit &other)
+	{
+		if (this != &other)
+			program_ = std::make_shared<Program>(*other.program_);
+
+		return *this;
+	}
+
+	int Circuit::count() const
+	{
+		return program_->count;
+	}
+
+	int Circuit::size() const
+	{
+		return static_cast<int>(program_->operations.size());
+	}
+
+	int Circuit::measurements() const
+	{
+		return program_->measurements;
+	}
+
+	int Circuit::steps() const
+	{
+		return static_cast<int>(program_->plan.size());
+	}
+
+	OptimisationReport Circuit::optimise()
+	{
+		return program_->optimise();
+	}
+
+	void Circuit::compile()
+	{
+		program_->lower();
+	}
+
+	Bitstring Circuit::run(QubitSystem &qs) const
+	{
+		const Program &p = *program_;
+		if (!p.compiled)
+			throw std::logic_error("Circuit must be compiled after recording");
+
+		while (qs.count() < p.count)
+			Qubit q(qs);
+
+		State &state = *qs.state_;
+		Bitstring result = 0;
+
+		if (qs.noisy_)
+		{
+			//Noise follows every gate as recorded, so the fused plan cannot be used
+			int bit = 0;
+			for (const Operation &op : p.operations)
+			{
+				if (op.op == Op::M)
+					result |= state.measure({ op.a }) << bit++;
+				else if (op.b < 0)
+				{
+					state.apply(op.m, op.a);
+					qs.apply_noise(op.a);
+				}
+				else
+				{
+					state.apply(op.m, op.a, op.b);
+					qs.apply_noise(op.a);
+					qs.apply_noise(op.b);
+				}
+			}
+
+			return result;
+		}
+
+		for (const Step &s : p.plan)
+		{
+			if (s.is_measurement())
+				result |= state.measure(s.measured) << s.bit;
+			else if (s.b < 0)
+				state.apply(s.m, s.a);
+			else
+				state.apply(s.m, s.a, s.b);
+		}
+
+		return result;
+	}
+
+	std::vector<Bitstring> Circuit::run(unsigned shots, Backend backend) const
+	{
+		if (!program_->compiled)
+			throw std::logic_error("Circuit must be compiled after recording");
+
+		std::vector<Bitstring> results(shots);
+		for_each_shot(shots, [&](QubitSystem &qs, unsigned shot) { results[shot] = run(qs); }, backend);
+
+		return results;
+	}
+}
@@ -0,0 +1,75 @@
+/**
+ * @file Circuit.h
+ *
+ * Internal header defining recorded circuits and their execution plans.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+namespace qlay
+{
+	//Operations a circuit can record
+	enum class Op
+	{
+		X, Y, Z, H, SRNOT,
+		Rx, Ry, Rz, Rp,
+		SWAP, SRSWAP, CNOT,
+		M
+	};
+
+	//Gate or measurement as recorded, on qubit a (and b for two-qubit gates)
+	struct Operation
+	{
+		Op op;
+		double angle = 0;
+		int a = 0;
+		int b = -1;   //-1 for single-qubit gates and measurements
+		Mat m;        //Operator, empty for measurements
+	};
+
+	//Single call on a State making up an execution plan: the operator m on qubit a
+	//(and b), or a joint measurement whose first outcome lands in the given result bit
+	struct Step
+	{
+		Mat m;
+		int a = 0;
+		int b = -1;
+		std::vector<int> measured;
+		int bit = 0;
+
+		bool is_measurement() const { return !measured.empty(); }
+	};
+
+	//Returns the operator of the given rotation (Rx, Ry, Rz or Rp) by the given angle
+	Mat rotation(Op op, double angle);
+
+	//Recorded operations of a Circuit, and the plan they were last lowered into
+	class Program
+	{
+	public:
+		std::vector<Operation> operations;
+		std::vector<Step> plan;
+		int count = 0;
+		int measurements = 0;
+		bool compiled = false;
+
+		//Appends the given operation, invalidating the plan
+		void record(Operation op);
+
+		//Cancels inverse pairs and merges rotations in the operations, invalidating the plan
+		OptimisationReport optimise();
+
+		//Returns the operations reordered, exchanging only those that commute, so that
+		//gates on the same qubits and gates on low-order qubits run consecutively
+		std::vector<Operation> schedule() const;
+
+		//Lowers the scheduled operations into the plan, fusing every single-qubit gate into
+		//a neighbouring gate on the same qubit, consecutive two-qubit gates on the same
+		//pair into one, and consecutive measurements into one joint measurement
+		void lower();
+	};
+}
@@ -0,0 +1,693 @@
+/**
+ * @file CompressedState.cpp
+ *
+ * Implements the compressed state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "CompressedState.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace qlay
+{
+	namespace
+	{
+		//Blocks hold 2^14 amplitudes, or 256 KiB decompressed
+		constexpr int BLOCK_QUBITS = 14;
+
+		//Enough blocks for a two-qubit gate across blocks, with room to spare
+		constexpr std::size_t CACHE_BLOCKS = 8;
+	}
+
+	CompressedState::CompressedState() : cache_(CACHE_BLOCKS)
+	{
+	}
+
+	int CompressedState::block_bits() const
+	{
+		return std::min(count_, BLOCK_QUBITS);
+	}
+
+	bool CompressedState::is_zero(Eigen::Index b) const
+	{
+		if (blocks_[b])
+			return false;
+
+		for (const Slot &s : cache_)
+			if (s.block == b && s.dirty)
+				return false;
+
+		return true;
+	}
+
+	Complex *CompressedState::touch(Eigen::Index b, bool write) const
+	{
+		//Reuse the cached copy, else evict the least recently used block
+		Slot *slot = &cache_[0];
+		for (Slot &s : cache_)
+		{
+			if (s.block == b)
+			{
+				slot = &s;
+				break;
+			}
+
+			//Empty slots are taken first
+			if ((s.block < 0 ? 0 : s.last_use) < (slot->block < 0 ? 0 : slot->last_use))
+				slot = &s;
+		}
+
+		if (slot->block != b)
+		{
+			if (slot->dirty)
+				blocks_[slot->block] = compress(slot->data.data());
+
+			slot->data.resize(static_cast<std::size_t>(block_size()));
+			decompress(blocks_[b].get(), slot->data.data());
+			slot->block = b;
+			slot->dirty = false;
+		}
+
+		slot->last_use = ++clock_;
+		slot->dirty |= write;
+		return slot->data.data();
+	}
+
+	void CompressedState::discard(Eigen::Index b)
+	{
+		blocks_[b] = nullptr;
+
+		for (Slot &s : cache_)
+			if (s.block == b)
+			{
+				s.block = -1;
+				s.dirty = false;
+			}
+	}
+
+	double CompressedState::norm(Eigen::Index b) const
+	{
+		for (const Slot &s : cache_)
+			if (s.block == b && s.dirty)
+			{
+				double n = 0;
+				for (const Complex &a : s.data)
+					n += std::norm(a);
+				return n;
+			}
+
+		const Block *block = blocks_[b].get();
+		if (!block)
+			return 0;
+
+		double n = 0;
+		for (std::size_t r = 0; r < block->values.size(); r++)
+			n += std::norm(block->values[r]) * (block->runs.empty() ? 1 : block->runs[r]);
+		return n;
+	}
+
+	std::vector<Eigen::Index> CompressedState::draw(const std::vector<double> &u) const
+	{
+		const Eigen::Index size = block_size();
+		const Eigen::Index blocks = static_cast<Eigen::Index>(blocks_.size());
+
+		//Lossy rounding leaves the norm slightly off 1, so the draws are scaled to match
+		double total = 0;
+		for (Eigen::Index b = 0; b < blocks; b++)
+			total += norm(b);
+
+		std::vector<Eigen::Index> results(u.size());
+		Eigen::Index last = -1; //Last nonzero block, for draws rounding leaves unmatched
+		double acc = 0;
+		std::size_t next = 0;
+
+		//Only blocks a draw falls within are decompressed
+		for (Eigen::Index b = 0; b < blocks && next < u.size(); b++)
+		{
+			const double n = norm(b);
+			if (n == 0)
+				continue;
+
+			last = b;
+			if (acc + n <= u[next] * total)
+			{
+				acc += n;
+				continue;
+			}
+
+			const Complex *v = touch(b, false);
+			for (Eigen::Index k = 0; k < size && next < u.size(); k++)
+			{
+				acc += std::norm(v[k]);
+				for (; next < u.size() && u[next] * total < acc; next++)
+					results[next] = b * size + k;
+			}
+		}
+
+		//Fall back on the last nonzero amplitude
+		if (next < u.size())
+		{
+			Eigen::Index k = size - 1;
+			if (last >= 0)
+			{
+				const Complex *v = touch(last, false);
+				while (k > 0 && v[k] == Complex(0))
+					k--;
+			}
+
+			for (; next < u.size(); next++)
+				results[next] = std::max(last, Eigen::Index(0)) * size + k;
+		}
+
+		return results;
+	}
+
+	void CompressedState::evict_all() const
+	{
+		for (Slot &s : cache_)
+		{
+			if (s.dirty)
+				blocks_[s.block] = compress(s.data.data());
+
+			s.block = -1;
+			s.dirty = false;
+		}
+	}
+
+	std::shared_ptr<const CompressedState::Block> CompressedState::compress(Complex *v) const
+	{
+		const Eigen::Index size = block_size();
+		compressions_++;
+
+		//Round each component to the nearest multiple of twice the allowed error, so
+		//tiny amplitudes become zero and nearly equal ones become equal
+		if (error_ > 0)
+		{
+			const double step = 2 * error_;
+			double moved = 0;
+			for (Eigen::Index i = 0; i < size; i++)
+			{
+				Complex r(std::round(v[i].real() / step) * step, std::round(v[i].imag() / step) * step);
+				moved += std::norm(v[i] - r);
+				v[i] = r;
+			}
+
+			//Distances add at worst, as later gates are unitary
+			rounding_ += std::sqrt(moved);
+		}
+
+		std::size_t runs = 1;
+		for (Eigen::Index i = 1; i < size; i++)
+			if (v[i] != v[i - 1])
+				runs++;
+
+		//All zero, stored as nothing
+		if (runs == 1 && v[0] == Complex(0))
+			return nullptr;
+
+		auto block = std::make_shared<Block>();
+		if (runs * (sizeof(Complex) + sizeof(std::uint32_t)) < size * sizeof(Complex))
+		{
+			block->values.reserve(runs);
+			block->runs.reserve(runs);
+			for (Eigen::Index i = 0; i < size; i++)
+			{
+				if (i > 0 && v[i] == block->values.back())
+					block->runs.back()++;
+				else
+				{
+					block->values.push_back(v[i]);
+					block->runs.push_back(1);
+				}
+			}
+		}
+		else
+			block->values.assign(v, v + size);
+
+		return block;
+	}
+
+	void CompressedState::decompress(const Block *block, Complex *v) const
+	{
+		const Eigen::Index size = block_size();
+		decompressions_++;
+
+		if (!block)
+			std::fill(v, v + size, Complex(0));
+		else if (block->runs.empty())
+			std::copy(block->values.begin(), block->values.end(), v);
+		else
+		{
+			for (std::size_t r = 0; r < block->runs.size(); r++)
+				v = std::fill_n(v, block->runs[r], block->values[r]);
+		}
+	}
+
+	template <typename F>
+	void CompressedState::visit(const std::vector<int> &bits, bool write, F f)
+	{
+		const int local = block_bits();
+		const Eigen::Index size = block_size();
+		const Eigen::Index blocks = static_cast<Eigen::Index>(blocks_.size());
+
+		//Bits selecting blocks are renumbered to follow the local bits of the copy
+		std::vector<int> mapped = bits;
+		std::vector<Eigen::Index> strides;
+		for (int &bit : mapped)
+			if (bit >= local)
+			{
+				strides.push_back(Eigen::Index(1) << (bit - local));
+				bit = local + static_cast<int>(strides.size()) - 1;
+			}
+
+		Eigen::Index high = 0;
+		for (Eigen::Index s : strides)
+			high |= s;
+
+		const Eigen::Index group = Eigen::Index(1) << strides.size();
+		std::vector<Eigen::Index> members(static_cast<std::size_t>(group));
+		if (group > 1)
+			scratch_.resize(static_cast<std::size_t>(group * size));
+
+		for (Eigen::Index c = 0; c < blocks; c++)
+		{
+			if (c & high)
+				continue;
+
+			bool zero = true;
+			for (Eigen::Index g = 0; g < group; g++)
+			{
+				Eigen::Index b = c;
+				for (std::size_t s = 0; s < strides.size(); s++)
+					if ((g >> s) & 1)
+						b |= strides[s];
+
+				members[g] = b;
+				zero &= is_zero(b);
+			}
+
+			if (zero)
+				continue;
+
+			if (group == 1)
+			{
+				f(touch(c, write), size, mapped);
+				continue;
+			}
+
+			for (Eigen::Index g = 0; g < group; g++)
+			{
+				const Complex *v = touch(members[g], false);
+				std::copy(v, v + size, scratch_.data() + g * size);
+			}
+
+			f(scratch_.data(), group * size, mapped);
+
+			if (write)
+				for (Eigen::Index g = 0; g < group; g++)
+				{
+					const Complex *v = scratch_.data() + g * size;
+					std::copy(v, v + size, touch(members[g], true));
+				}
+		}
+	}
+
+	void CompressedState::add_qubit()
+	{
+		//|0> (x) |psi> leaves the existing amplitudes in the lower half
+		evict_all();
+
+		if (count_++ == 0)
+		{
+			blocks_.assign(1, nullptr);
+			touch(0, true)[0] = 1;
+		}
+		else if (count_ <= BLOCK_QUBITS)
+		{
+			//The single block doubles in size, so is rebuilt
+			std::vector<Complex> v(static_cast<std::size_t>(block_size()), Complex(0));
+			count_--;
+			decompress(blocks_[0].get(), v.data());
+			count_++;
+			blocks_[0] = compress(v.data());
+		}
+		else
+			blocks_.resize(2 * blocks_.size());
+	}
+
+	void CompressedState::reset()
+	{
+		//Set to |0...0> state
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+			discard(b);
+
+		if (count_ > 0)
+			touch(0, true)[0] = 1;
+
+		rounding_ = 0;
+	}
+
+	void CompressedState::set_truncation(const Truncation &truncation)
+	{
+		error_ = truncation.compression_error;
+	}
+
+	void CompressedState::apply(const Mat &m, int q)
+	{
+		visit({ q }, true, [&](Complex *v, Eigen::Index size, const std::vector<int> &bits)
+		{
+			apply_kernel(v, size, m, bits[0]);
+		});
+	}
+
+	void CompressedState::apply(const Mat &m, int a, int b)
+	{
+		visit({ a, b }, true, [&](Complex *v, Eigen::Index size, const std::vector<int> &bits)
+		{
+			apply_kernel(v, size, m, bits[0], bits[1]);
+		});
+	}
+
+	void CompressedState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//||K|psi>||^2 = tr(K rho K^dagger), so one pass finding the reduced density
+		//matrix rho of the qubit gives the probability of every Kraus operator
+		Mat rho = Mat::Zero(2, 2);
+		visit({ q }, false, [&](Complex *v, Eigen::Index size, const std::vector<int> &bits)
+		{
+			const Eigen::Index mask = Eigen::Index(1) << bits[0];
+			for (Eigen::Index k = 0; k < size / 2; k++)
+			{
+				Eigen::Index i0 = insert_zero(k, bits[0]);
+				Complex a0 = v[i0], a1 = v[i0 | mask];
+				rho(0, 0) += std::norm(a0);
+				rho(0, 1) += a0 * std::conj(a1);
+				rho(1, 1) += std::norm(a1);
+			}
+		});
+		rho(1, 0) = std::conj(rho(0, 1));
+
+		//Unravel the channel: pick one Kraus operator with probability ||K|psi>||^2
+		double u = rng.uniform();
+
+		std::size_t chosen = 0;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			double pk = (kraus[k] * rho * kraus[k].adjoint()).trace().real();
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = k;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		apply(kraus[chosen] / std::sqrt(p), q);
+	}
+
+	double CompressedState::probability(int q) const
+	{
+		const Eigen::Index mask = Eigen::Index(1) << q;
+		const Eigen::Index size = block_size();
+
+		double p = 0;
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			if (is_zero(b))
+				continue;
+
+			const Complex *v = touch(b, false);
+			for (Eigen::Index k = 0; k < size; k++)
+				if (((b * size) + k) & mask)
+					p += std::norm(v[k]);
+		}
+
+		return p;
+	}
+
+	double CompressedState::probability(Bitstring outcome) const
+	{
+		//Only the block holding the amplitude is decompressed
+		const Eigen::Index i = static_cast<Eigen::Index>(outcome);
+		const Eigen::Index b = i >> block_bits();
+		if (is_zero(b))
+			return 0;
+
+		return std::norm(touch(b, false)[i & (block_size() - 1)]);
+	}
+
+	std::vector<double> CompressedState::marginal(const std::vector<int> &indices) const
+	{
+		const int local = block_bits();
+		const Eigen::Index size = block_size();
+
+		//Only qubits within a block are marginalised there, each outcome of them placed at
+		//its bits of the register, so the work per block never exceeds its size
+		std::vector<int> inner, places;
+		for (std::size_t j = 0; j < indices.size(); j++)
+			if (indices[j] < local)
+			{
+				inner.push_back(indices[j]);
+				places.push_back(static_cast<int>(j));
+			}
+
+		std::vector<Bitstring> spread(std::size_t(1) << inner.size());
+		for (std::size_t m = 0; m < spread.size(); m++)
+			spread[m] = static_cast<Bitstring>(scatter_bits(m, places));
+
+		//Bits within a block and bits selecting it are disjoint, so their outcomes combine by OR
+		std::vector<double> p(std::size_t(1) << indices.size(), 0.0);
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			if (is_zero(b))
+				continue;
+
+			const Complex *v = touch(b, false);
+			Bitstring high = gather_bits(b * size, indices);
+			std::vector<double> part = marginalise(size, inner, [v](Eigen::Index k) { return std::norm(v[k]); });
+
+			for (std::size_t m = 0; m < part.size(); m++)
+				if (part[m] > 0)
+					p[high | spread[m]] += part[m];
+		}
+
+		return p;
+	}
+
+	void CompressedState::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		const int local = block_bits();
+		const Eigen::Index size = block_size();
+
+		//Outcome bits of the qubits selecting blocks, which decide whole blocks at once
+		Bitstring high_mask = 0;
+		for (std::size_t j = 0; j < indices.size(); j++)
+			if (indices[j] >= local)
+				high_mask |= Bitstring(1) << j;
+
+		//Zero contradictory amplitudes and renormalise the rest in one pass
+		const double scale = 1.0 / std::sqrt(p);
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			if (is_zero(b))
+				continue;
+
+			if ((gather_bits(b * size, indices) ^ outcome) & high_mask)
+			{
+				discard(b);
+				continue;
+			}
+
+			Complex *v = touch(b, true);
+			for (Eigen::Index k = 0; k < size; k++)
+				v[k] = gather_bits(b * size + k, indices) == outcome ? v[k] * scale : Complex(0);
+		}
+	}
+
+	Bitstring CompressedState::measure(const std::vector<int> &indices)
+	{
+		check_register(indices, count_);
+
+		const int local = block_bits();
+		const Eigen::Index size = block_size();
+
+		//Draw one basis state, rather than building all 2^k joint outcomes
+		const Bitstring result = gather_bits(draw({ rng.uniform() })[0], indices);
+
+		Bitstring high_mask = 0, low_mask = 0;
+		for (std::size_t j = 0; j < indices.size(); j++)
+			(indices[j] >= local ? high_mask : low_mask) |= Bitstring(1) << j;
+
+		//Blocks contradicting the outcome are skipped, and those measured only by the
+		//bits selecting them are counted from their compressed runs
+		double p = 0;
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			if (is_zero(b) || ((gather_bits(b * size, indices) ^ result) & high_mask))
+				continue;
+
+			if (!low_mask)
+			{
+				p += norm(b);
+				continue;
+			}
+
+			const Complex *v = touch(b, false);
+			for (Eigen::Index k = 0; k < size; k++)
+				if (gather_bits(b * size + k, indices) == result)
+					p += std::norm(v[k]);
+		}
+
+		collapse(indices, result, p);
+		return result;
+	}
+
+	std::vector<Bitstring> CompressedState::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		check_register(indices, count_);
+
+		std::vector<double> u(shots);
+		rng.fill_uniform(u.data(), u.size());
+
+		//Visit the draws in increasing order, so that one pass serves them all
+		std::vector<unsigned> order(shots);
+		for (unsigned i = 0; i < shots; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return u[a] < u[b]; });
+
+		std::vector<double> sorted(shots);
+		for (unsigned i = 0; i < shots; i++)
+			sorted[i] = u[order[i]];
+
+		const std::vector<Eigen::Index> states = draw(sorted);
+		std::vector<Bitstring> results(shots);
+		for (unsigned i = 0; i < shots; i++)
+			results[order[i]] = gather_bits(states[i], indices);
+
+		return results;
+	}
+
+	double CompressedState::expectation(const PauliString &p) const
+	{
+		const int local = block_bits();
+		const Eigen::Index size = block_size();
+		const Eigen::Index x = static_cast<Eigen::Index>(p.x_mask());
+		const Bitstring z = p.z_mask();
+
+		//P|j> = i^(#Y) (-1)^(popcount(j & z)) |j ^ x>, pairing each block with the one x maps it to
+		Complex sum = 0;
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			const Eigen::Index partner = b ^ (x >> local);
+			if (is_zero(b) || is_zero(partner))
+				continue;
+
+			const Complex *v = touch(b, false);
+			const Complex *w = touch(partner, false);
+			for (Eigen::Index k = 0; k < size; k++)
+			{
+				Eigen::Index j = b * size + k;
+				Complex term = std::conj(w[(j ^ x) & (size - 1)]) * v[k];
+				sum += parity(static_cast<Bitstring>(j) & z) ? -term : term;
+			}
+		}
+
+		//The result is real for a Hermitian P
+		return (pauli_phase(p) * sum).real();
+	}
+
+	void CompressedState::print(std::ostream &os, int count) const
+	{
+		const Eigen::Index size = block_size();
+
+		//Gather the amplitudes into a dense vector
+		Ket v = Ket::Zero(count_ ? Eigen::Index(1) << count_ : 0);
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+			if (!is_zero(b))
+				std::copy_n(touch(b, false), size, v.data() + b * size);
+
+		StateVector(std::move(v), count).print(os, count);
+	}
+
+	BackendReport CompressedState::report() const
+	{
+		double memory = 0;
+		for (const auto &block : blocks_)
+			if (block)
+				memory += block->values.capacity() * sizeof(Complex) + block->runs.capacity() * sizeof(std::uint32_t);
+		for (const Slot &s : cache_)
+			memory += s.data.capacity() * sizeof(Complex);
+
+		const double amplitudes = count_ ? std::ldexp(1.0, count_) : 0;
+
+		std::ostringstream reason;
+		reason << "Chosen explicitly; compressed " << amplitudes * sizeof(Complex) / std::max(memory, 1.0)
+			<< ":1 including the cache, after " << compressions_ << " compressions and "
+			<< decompressions_ << " decompressions";
+		if (rounding_ > 0)
+			reason << "; lossy rounding has moved the state by at most " << rounding_;
+
+		return { Backend::Compressed, memory, amplitudes, reason.str() };
+	}
+
+	std::unique_ptr<State> CompressedState::fork() const
+	{
+		//Write back the cache so the fork shares every block, and start it with an empty cache
+		evict_all();
+
+		auto f = std::make_unique<CompressedState>(*this);
+		for (Slot &s : f->cache_)
+			s.data = std::vector<Complex>();
+
+		return f;
+	}
+
+	void CompressedState::save(std::ostream &os) const
+	{
+		const Eigen::Index size = block_size();
+		const std::vector<Complex> zeros(static_cast<std::size_t>(size), Complex(0));
+
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			const Complex *v = is_zero(b) ? zeros.data() : touch(b, false);
+			os.write(reinterpret_cast<const char *>(v), size * sizeof(Complex));
+		}
+	}
+
+	void CompressedState::load(const Complex *v, int count, const std::vector<int> &layout)
+	{
+		for (Slot &s : cache_)
+		{
+			s.block = -1;
+			s.dirty = false;
+		}
+
+		count_ = count;
+		rounding_ = 0;
+		const Eigen::Index size = block_size();
+		blocks_.assign(count ? static_cast<std::size_t>((Eigen::Index(1) << count) / size) : 0, nullptr);
+
+		bool identity = true;
+		for (int q = 0; q < count; q++)
+			identity &= layout[q] == q;
+
+		//Compress one block at a time, so the whole state is never held decompressed
+		std::vector<Complex> block(static_cast<std::size_t>(size));
+		for (Eigen::Index b = 0; b < static_cast<Eigen::Index>(blocks_.size()); b++)
+		{
+			for (Eigen::Index k = 0; k < size; k++)
+				block[k] = identity ? v[b * size + k] : v[scatter_bits(static_cast<Bitstring>(b * size + k), layout)];
+
+			blocks_[b] = compress(block.data());
+		}
+	}
+}
@@ -0,0 +1,118 @@
+/**
+ * @file CompressedState.h
+ *
+ * Internal header defining the compressed state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "StateVector.h"
+
+#include <cstdint>
+
+namespace qlay
+{
+	//Dense state vector split into fixed-size blocks of amplitudes, each compressed
+	//independently, so states with runs of zero or repeated amplitudes (such as
+	//after measurement) take a fraction of the memory of a StateVector. Blocks are
+	//decompressed into a small working cache when touched and recompressed once
+	//evicted. A nonzero Truncation::compression_error makes compression lossy,
+	//first rounding each component to within that error. The rounding is repeated
+	//each time a modified block is recompressed, so its effect accumulates; the
+	//distance it has moved the state is tracked and reported. Compressed blocks are
+	//immutable and shared between forks, so only the blocks modified are copied.
+	class CompressedState : public State
+	{
+	private:
+		//Compressed block of amplitudes: runs of equal amplitudes, or the amplitudes
+		//themselves should runs save nothing
+		struct Block
+		{
+			std::vector<Complex> values;
+			std::vector<std::uint32_t> runs; //Length of each run of values, empty when raw
+		};
+
+		//Decompressed block held in the working cache
+		struct Slot
+		{
+			std::vector<Complex> data;
+			Eigen::Index block = -1;
+			std::size_t last_use = 0;
+			bool dirty = false;
+		};
+
+		mutable std::vector<std::shared_ptr<const Block>> blocks_; //Null when all zero
+		mutable std::vector<Slot> cache_;
+		mutable std::size_t clock_ = 0;
+		mutable std::size_t compressions_ = 0;
+		mutable std::size_t decompressions_ = 0;
+		std::vector<Complex> scratch_;
+		double error_ = 0;
+		mutable double rounding_ = 0; //Bound on the distance lossy rounding has moved the state
+		int count_ = 0;
+
+		//Number of qubits indexing amplitudes within a block
+		int block_bits() const;
+		Eigen::Index block_size() const { return Eigen::Index(1) << block_bits(); }
+
+		//Returns whether the given block is known to be all zero without decompressing it
+		bool is_zero(Eigen::Index b) const;
+
+		//Returns the decompressed amplitudes of the given block, loading it into the
+		//cache should it be absent. The pointer stays valid until another block is loaded
+		//while this one is the least recently used.
+		Complex *touch(Eigen::Index b, bool write) const;
+
+		//Sets the given block to all zero without decompressing it
+		void discard(Eigen::Index b);
+
+		//Returns the total probability of the given block, from its compressed runs
+		//unless it has been modified in the cache
+		double norm(Eigen::Index b) const;
+
+		//Returns the basis state each of the given ascending uniform draws selects from the
+		//cumulative distribution, in one pass skipping blocks by their totals
+		std::vector<Eigen::Index> draw(const std::vector<double> &u) const;
+
+		//Writes back every modified block and empties the cache
+		void evict_all() const;
+
+		//Returns the compressed block of the given amplitudes, or null should they all be zero
+		std::shared_ptr<const Block> compress(Complex *v) const;
+		void decompress(const Block *block, Complex *v) const;
+
+		//Calls f(v, size, bits) on each group of blocks the given bits act within, skipping
+		//groups that are all zero. Bits selecting blocks are gathered into a contiguous
+		//copy, with bits renumbered to match, and written back should write be set.
+		template <typename F>
+		void visit(const std::vector<int> &bits, bool write, F f);
+
+	public:
+		CompressedState();
+
+		void add_qubit() override;
+		void reset() override;
+		void set_truncation(const Truncation &truncation) override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+
+		void save(std::ostream &os) const override;
+		void load(const Complex *v, int count, const std::vector<int> &layout) override;
+	};
+}
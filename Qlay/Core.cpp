@@ -8,26 +8,58 @@
 
 #include "Core.h"
 
+#include <atomic>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
 namespace qlay
 {
-	std::default_random_engine rng;
+	static std::atomic<std::uint64_t> seed_{ 0 };
+
+	//Threads which never call init() each take a distinct stream of the global seed
+	static std::atomic<std::uint64_t> next_thread_stream_{ 0 };
+
+	thread_local Philox rng(seed_.load(), next_thread_stream_++);
 
 	void init()
 	{
-		rng.seed(static_cast<unsigned>(
+		init(static_cast<unsigned>(
 			std::chrono::high_resolution_clock::now().time_since_epoch().count()
 			));
 	}
 
 	void init(unsigned seed)
 	{
-		rng.seed(seed);
+		seed_ = seed;
+		rng.seed_stream(seed, 0);
+	}
+
+	static std::mutex scratch_mutex_;
+	static std::string scratch_directory_;
+
+	void set_scratch_directory(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(scratch_mutex_);
+		scratch_directory_ = path;
+	}
+
+	std::string scratch_directory()
+	{
+		{
+			std::lock_guard<std::mutex> lock(scratch_mutex_);
+			if (!scratch_directory_.empty())
+				return scratch_directory_;
+		}
+
+		const char *env = std::getenv("QLAY_SCRATCH");
+		return env ? env : "";
 	}
 
 	bool chance(double p)
 	{
-		std::bernoulli_distribution dist(p);
-		return dist(rng);
+		return rng.uniform() < p;
 	}
 
 	double deg_to_rad(double angle)
@@ -46,4 +78,97 @@ namespace qlay
 
 		return k;
 	}
+
+	void check_register(const std::vector<int> &indices, int count)
+	{
+		if (indices.size() > MAX_REGISTER)
+			throw std::length_error("Joint outcomes hold at most " + std::to_string(MAX_REGISTER) + " qubits");
+
+		std::vector<bool> seen(static_cast<std::size_t>(std::max(count, 0)));
+		for (int q : indices)
+		{
+			if (q < 0 || q >= count)
+				throw std::out_of_range("Qubit index " + std::to_string(q) + " is beyond the qubits of the system");
+			if (seen[q])
+				throw std::invalid_argument("Qubit index " + std::to_string(q) + " appears more than once");
+
+			seen[q] = true;
+		}
+	}
+
+	Bitstring gather_bits(Eigen::Index x, const std::vector<int> &indices)
+	{
+		Bitstring b = 0;
+
+		for (std::size_t i = 0; i < indices.size(); i++)
+			b |= static_cast<Bitstring>((x >> indices[i]) & 1) << i;
+
+		return b;
+	}
+
+	Eigen::Index scatter_bits(Bitstring x, const std::vector<int> &indices)
+	{
+		Eigen::Index i = 0;
+
+		for (std::size_t j = 0; j < indices.size(); j++)
+			i |= static_cast<Eigen::Index>((x >> j) & 1) << indices[j];
+
+		return i;
+	}
+
+	AliasTable::AliasTable(const std::vector<double> &weights)
+		: prob_(weights.size()), alias_(weights.size())
+	{
+		double total = 0;
+		for (double w : weights)
+			total += w;
+
+		//Scale so that the average column holds exactly 1
+		std::vector<std::size_t> small, large;
+		double n = static_cast<double>(weights.size());
+		for (std::size_t i = 0; i < weights.size(); i++)
+		{
+			prob_[i] = weights[i] * n / total;
+			(prob_[i] < 1.0 ? small : large).push_back(i);
+		}
+
+		//Top up each underfull column with the excess of an overfull one
+		while (!small.empty() && !large.empty())
+		{
+			std::size_t s = small.back(); small.pop_back();
+			std::size_t l = large.back();
+
+			alias_[s] = l;
+			prob_[l] -= 1.0 - prob_[s];
+
+			if (prob_[l] < 1.0)
+			{
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+
+		//Remaining columns are full, up to rounding error
+		for (std::size_t i : small) { prob_[i] = 1.0; alias_[i] = i; }
+		for (std::size_t i : large) { prob_[i] = 1.0; alias_[i] = i; }
+	}
+
+	void print_complex(std::ostream &os, Complex z)
+	{
+		if (z.real() == 0 && z.imag() == 0)
+			os << 0;
+		else
+		{
+			if (z.real() != 0)
+				os << z.real();
+
+			if (z.imag() != 0)
+			{
+				os << (z.imag() > 0 ? "+" : "-");
+				if (std::abs(z.imag()) != 1)
+					os << std::abs(z.imag());
+				os << "i";
+			}
+		}
+	}
 }
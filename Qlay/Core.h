@@ -13,13 +13,81 @@
 #include <random>
 #include <chrono>
 #include <complex>
+#include <cstdint>
+#include <algorithm>
+#include <ostream>
 
 #include <Eigen/Dense>
 
 namespace qlay
 {
-	//Global RNG used to simulate nondeterminism
-	extern std::default_random_engine rng;
+	//Counter-based Philox4x32-10 generator; each (seed, stream) pair is an
+	//independent sequence, so streams can be split deterministically
+	class Philox
+	{
+	public:
+		using result_type = std::uint32_t;
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return 0xFFFFFFFF; }
+
+		//Number of uniform doubles buffered for uniform()
+		static constexpr int UNIFORM_BUFFER = 64;
+
+		Philox(std::uint64_t seed = 0, std::uint64_t stream = 0) { seed_stream(seed, stream); }
+
+		//Restarts at the beginning of the given stream
+		void seed_stream(std::uint64_t seed, std::uint64_t stream)
+		{
+			key_ = seed;
+			stream_ = stream;
+			position_ = 0;
+			used_ = 4;
+			uniforms_used_ = UNIFORM_BUFFER;
+		}
+
+		result_type operator()()
+		{
+			if (used_ == 4)
+				refill();
+
+			return buffer_[used_++];
+		}
+
+		//Returns a uniform double in [0, 1), drawn from an internal bulk-filled buffer
+		double uniform()
+		{
+			if (uniforms_used_ == UNIFORM_BUFFER)
+			{
+				fill_uniform(uniforms_, UNIFORM_BUFFER);
+				uniforms_used_ = 0;
+			}
+
+			return uniforms_[uniforms_used_++];
+		}
+
+		//Fills the given buffer with n uniform doubles in [0, 1), several counter blocks at a time
+		void fill_uniform(double *out, std::size_t n);
+
+	private:
+		std::uint64_t key_;
+		std::uint64_t stream_;
+		std::uint64_t position_;
+		result_type buffer_[4];
+		int used_;
+		double uniforms_[UNIFORM_BUFFER];
+		int uniforms_used_;
+
+		//Encrypts the next counter block into the output buffer
+		void refill();
+	};
+
+	//Per-thread RNG used to simulate nondeterminism
+	extern thread_local Philox rng;
+
+	//Returns the directory set for scratch files, else QLAY_SCRATCH, else empty for the
+	//temporary directory
+	std::string scratch_directory();
 
 	//Complex number
 	using Complex = std::complex<double>;
@@ -33,23 +101,254 @@ namespace qlay
 	//Generic matrix
 	using Mat = Eigen::Matrix<Complex, Eigen::Dynamic, Eigen::Dynamic>;
 
-	//State vector wrapper class
+	//Simulation backend interface; each QubitSystem owns one State holding its
+	//qubits, with qubit i corresponding to bit i of a computational basis index
 	class State
 	{
-	private:
-		Ket v;
-
 	public:
-		//References the Eigen state vector
-		inline Ket &get() { return v; }
+		virtual ~State() = default;
+
+		//Appends a new qubit in the |0> state as the most significant qubit
+		virtual void add_qubit() = 0;
+
+		//Sets all qubits to the |0> state
+		virtual void reset() = 0;
+
+		//Sets the truncation limits of approximate backends; exact backends ignore it
+		virtual void set_truncation(const Truncation &) {}
+
+		//Applies the 2x2 operator m to qubit q
+		virtual void apply(const Mat &m, int q) = 0;
+
+		//Applies the 4x4 operator m to qubits a and b, with a as the high-order input
+		virtual void apply(const Mat &m, int a, int b) = 0;
+
+		//Applies the channel given by 2x2 Kraus operators to qubit q
+		virtual void apply_channel(const std::vector<Mat> &kraus, int q) = 0;
+
+		//Applies X, Y or Z to qubit q with the given respective probabilities. By
+		//default one outcome is sampled, costing nothing when no error is drawn.
+		virtual void apply_pauli_channel(double px, double py, double pz, int q);
+
+		//Returns the probability of measuring qubit q as |1>
+		virtual double probability(int q) const = 0;
+
+		//Returns the probability of measuring all qubits as the given outcome
+		virtual double probability(Bitstring outcome) const = 0;
+
+		//Returns the joint outcome distribution of the qubits at the given indices
+		virtual std::vector<double> marginal(const std::vector<int> &indices) const = 0;
+
+		//Projects the qubits at the given indices onto the given outcome, which has probability p
+		virtual void collapse(const std::vector<int> &indices, Bitstring outcome, double p) = 0;
+
+		//Measures the qubits at the given indices, collapsing onto and returning a joint outcome.
+		//By default measures one qubit after another, so the 2^k outcomes are never held.
+		virtual Bitstring measure(const std::vector<int> &indices);
+
+		//Draws joint outcomes of the qubits at the given indices without collapsing. By
+		//default builds an alias table over marginal() for registers of up to
+		//MAX_SAMPLE_TABLE qubits, and otherwise measures a fork for each shot.
+		virtual std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const;
+
+		//Returns the expectation value of the given Pauli string
+		virtual double expectation(const PauliString &p) const = 0;
+
+		//Prints a human-readable description of the state
+		virtual void print(std::ostream &os, int count) const = 0;
+
+		//Describes this backend and its estimated cost
+		virtual BackendReport report() const = 0;
+
+		//Returns an independent copy of this state, sharing storage copy-on-write where possible
+		virtual std::unique_ptr<State> fork() const = 0;
+
+		//Returns the bit of the amplitudes written by save() holding each qubit, or empty
+		//should qubit i be held by bit i
+		virtual std::vector<int> layout() const { return {}; }
+
+		//Writes all 2^n amplitudes in order of the bits given by layout(). By default
+		//throws std::domain_error, the state not being held as amplitudes.
+		virtual void save(std::ostream &os) const;
+
+		//Replaces the state by count qubits with the given amplitudes, where bit layout[i]
+		//holds qubit i. By default throws std::domain_error.
+		virtual void load(const Complex *v, int count, const std::vector<int> &layout);
+
+	protected:
+		//Measures by drawing one joint outcome from marginal() then calling collapse(),
+		//in two passes, for backends whose states are no smaller than the 2^k outcomes
+		Bitstring measure_marginal(const std::vector<int> &indices);
+
+		//Samples through an alias table over marginal()
+		std::vector<Bitstring> sample_marginal(unsigned shots, const std::vector<int> &indices) const;
 	};
 
+	//Widest register State::sample() draws from a table of its outcomes
+	constexpr std::size_t MAX_SAMPLE_TABLE = 20;
+
+	//Constructs an empty State of the given backend
+	std::shared_ptr<State> make_state(Backend backend);
+
 	// |0> basis vector
 	const Ket ZERO ((Ket(2) << 1, 0).finished());
 
 	// |1> basis vector
 	const Ket ONE  ((Ket(2) << 0, 1).finished());
 
+	//Pauli operators
+	const Mat PAULI_X ((Mat(2, 2) << 0, 1, 1, 0).finished());
+	const Mat PAULI_Y ((Mat(2, 2) << 0, Complex(0, -1), Complex(0, 1), 0).finished());
+	const Mat PAULI_Z ((Mat(2, 2) << 1, 0, 0, -1).finished());
+
+	//Throws std::invalid_argument unless the given Pauli error probabilities are
+	//nonnegative and sum to at most 1
+	void check_pauli_probabilities(double px, double py, double pz);
+
+	//Returns whether the given bits all lie within the lowest count
+	inline bool within_qubits(Bitstring bits, int count)
+	{
+		return count >= 64 || (bits >> count) == 0;
+	}
+
 	//Computes the Kronecker product of the given matrices
 	Mat kronecker_product(const Mat &a, const Mat &b);
+
+	//Returns the parity (number of set bits modulo 2) of x
+	inline bool parity(Bitstring x)
+	{
+		for (int shift = 32; shift > 0; shift >>= 1)
+			x ^= x >> shift;
+
+		return x & 1;
+	}
+
+	//Most qubits in a joint outcome, so that all 2^k outcomes can be indexed
+	constexpr std::size_t MAX_REGISTER = 63;
+
+	//Throws std::length_error should the qubits at the given indices exceed MAX_REGISTER,
+	//std::out_of_range should any not be one of the count qubits, or std::invalid_argument
+	//should any be repeated
+	void check_register(const std::vector<int> &indices, int count);
+
+	//Gathers the bits of x at the given indices into a packed integer; at most 64 indices
+	Bitstring gather_bits(Eigen::Index x, const std::vector<int> &indices);
+
+	//Scatters bit i of x to bit indices[i], the inverse of gather_bits
+	Eigen::Index scatter_bits(Bitstring x, const std::vector<int> &indices);
+
+	//Below this many amplitude pairs, kernels run on a single thread
+	constexpr Eigen::Index PARALLEL_THRESHOLD = Eigen::Index(1) << 14;
+
+	//Number of fixed slices of the basis histogrammed separately by marginalise
+	constexpr Eigen::Index MARGINAL_SLICES = 64;
+
+	//Histograms prob(i) over basis indices below size, a power of two, into the joint
+	//outcome distribution of the qubits at the given indices. Each outcome is summed in
+	//the same order however many threads run, so the result is reproducible.
+	template <typename Prob>
+	std::vector<double> marginalise(Eigen::Index size, const std::vector<int> &indices, Prob prob)
+	{
+		const Eigen::Index outcomes = Eigen::Index(1) << indices.size();
+		std::vector<double> p(static_cast<std::size_t>(outcomes), 0.0);
+		if (size == 0)
+			return p;
+
+		bool identity = true;
+		for (std::size_t j = 0; j < indices.size(); j++)
+			identity &= indices[j] == static_cast<int>(j);
+
+		//Every qubit in order, so each outcome is a single basis state
+		if (identity && outcomes == size)
+		{
+			#pragma omp parallel for if(size >= PARALLEL_THRESHOLD)
+			for (Eigen::Index i = 0; i < size; i++)
+				p[i] = prob(i);
+
+			return p;
+		}
+
+		//Few outcomes: fixed slices of the basis each fill a private histogram, merged
+		//in slice order, together holding no more entries than there are basis states
+		const Eigen::Index slices = std::min(MARGINAL_SLICES, size);
+		if (outcomes * slices <= size)
+		{
+			const Eigen::Index length = size / slices;
+			std::vector<std::vector<double>> partial(static_cast<std::size_t>(slices));
+
+			#pragma omp parallel for if(size >= PARALLEL_THRESHOLD)
+			for (Eigen::Index s = 0; s < slices; s++)
+			{
+				std::vector<double> &local = partial[s];
+				local.assign(p.size(), 0.0);
+
+				for (Eigen::Index i = s * length; i < (s + 1) * length; i++)
+					local[gather_bits(i, indices)] += prob(i);
+			}
+
+			for (const std::vector<double> &local : partial)
+				for (std::size_t j = 0; j < p.size(); j++)
+					p[j] += local[j];
+
+			return p;
+		}
+
+		//Many outcomes: each is summed alone over the basis states agreeing with it, in
+		//increasing order of the other bits, so no histogram is duplicated
+		Eigen::Index selected = 0;
+		for (int q : indices)
+			if (q < 63)
+				selected |= Eigen::Index(1) << q;
+
+		const Eigen::Index others = (size - 1) & ~selected;
+
+		#pragma omp parallel for if(size >= PARALLEL_THRESHOLD)
+		for (Eigen::Index j = 0; j < outcomes; j++)
+		{
+			//Outcomes setting bits beyond the basis have no states
+			const Eigen::Index base = scatter_bits(static_cast<Bitstring>(j), indices);
+			if (base & ~(size - 1))
+				continue;
+
+			double sum = 0;
+			Eigen::Index f = 0;
+			do
+			{
+				sum += prob(base | f);
+				f = (f - others) & others;
+			} while (f != 0);
+
+			p[j] = sum;
+		}
+
+		return p;
+	}
+
+	//Returns i^(number of Y factors) for the given Pauli string
+	Complex pauli_phase(const PauliString &p);
+
+	//Prints a complex coefficient in the form a+bi
+	void print_complex(std::ostream &os, Complex z);
+
+	//Walker/Vose alias table for O(1) sampling from a discrete distribution
+	class AliasTable
+	{
+	private:
+		std::vector<double> prob_;
+		std::vector<std::size_t> alias_;
+
+	public:
+		//Builds the table from the given (not necessarily normalised) weights
+		AliasTable(const std::vector<double> &weights);
+
+		//Maps a uniform double in [0, 1) to an outcome index
+		std::size_t operator()(double u) const
+		{
+			//Integer part picks the column, fractional part tosses its coin
+			double scaled = u * static_cast<double>(prob_.size());
+			std::size_t i = std::min(static_cast<std::size_t>(scaled), prob_.size() - 1);
+
+			return scaled - static_cast<double>(i) < prob_[i] ? i : alias_[i];
+		}
+	};
 }
@@ -0,0 +1,581 @@
+/**
+ * @file DecisionDiagram.cpp
+ *
+ * Implements the decision diagram backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "DecisionDiagram.h"
+
+#include <cmath>
+#include <functional>
+
+namespace qlay
+{
+	namespace
+	{
+		//Collect garbage no earlier than this many nodes
+		constexpr std::size_t MIN_GC_LIMIT = std::size_t(1) << 16;
+
+		//Values beyond this magnitude are stored without deduplication, keeping grid coordinates in range
+		constexpr double MAX_DEDUPLICATED = 1e5;
+
+		//Tests against an absolute tolerance, so only for node weights, which are at most
+		//one in magnitude, and sums of them; never for the root edge, whose weight carries
+		//the global normalisation and falls below the tolerance for wide states
+		bool is_zero(Complex c)
+		{
+			return std::abs(c.real()) < ComplexTable::TOLERANCE && std::abs(c.imag()) < ComplexTable::TOLERANCE;
+		}
+
+		//Returns whether an edge is absent, which the complex table stores as exactly zero,
+		//so is safe at any scale
+		bool is_absent(Complex c)
+		{
+			return c == Complex(0);
+		}
+	}
+
+	ComplexTable::ComplexTable()
+	{
+		lookup(0);
+		lookup(1);
+	}
+
+	int ComplexTable::lookup(Complex c)
+	{
+		if (!values_.empty() && is_zero(c))
+			return ZERO;
+
+		if (std::abs(c.real()) > MAX_DEDUPLICATED || std::abs(c.imag()) > MAX_DEDUPLICATED)
+		{
+			values_.push_back(c);
+			return static_cast<int>(values_.size()) - 1;
+		}
+
+		//A value within tolerance lies in this cell or a neighbour
+		long long re = std::llround(c.real() / TOLERANCE);
+		long long im = std::llround(c.imag() / TOLERANCE);
+
+		for (long long dr = -1; dr <= 1; dr++)
+			for (long long di = -1; di <= 1; di++)
+			{
+				auto it = cells_.find(cell(re + dr, im + di));
+				if (it == cells_.end())
+					continue;
+
+				Complex v = values_[it->second];
+				if (std::abs(v.real() - c.real()) < TOLERANCE && std::abs(v.imag() - c.imag()) < TOLERANCE)
+					return it->second;
+			}
+
+		values_.push_back(c);
+		int index = static_cast<int>(values_.size()) - 1;
+		cells_.emplace(cell(re, im), index);
+
+		return index;
+	}
+
+	std::size_t DecisionDiagram::NodeHash::operator()(const Node &n) const
+	{
+		std::size_t h = static_cast<std::size_t>(n.level);
+		for (int v : { n.next[0], n.next[1], n.weight[0], n.weight[1] })
+			h = h * 0x100000001b3ULL ^ static_cast<std::size_t>(v);
+
+		return h;
+	}
+
+	bool DecisionDiagram::NodeEqual::operator()(const Node &a, const Node &b) const
+	{
+		return a.level == b.level && a.next[0] == b.next[0] && a.next[1] == b.next[1]
+			&& a.weight[0] == b.weight[0] && a.weight[1] == b.weight[1];
+	}
+
+	std::size_t DecisionDiagram::SumHash::operator()(const SumKey &k) const
+	{
+		std::size_t h = static_cast<std::size_t>(k.x);
+		h = h * 0x100000001b3ULL ^ static_cast<std::size_t>(k.y);
+		h = h * 0x100000001b3ULL ^ static_cast<std::size_t>(k.ratio);
+
+		return h;
+	}
+
+	DecisionDiagram::DecisionDiagram() : gc_limit_(MIN_GC_LIMIT)
+	{
+		reset();
+	}
+
+	DecisionDiagram::Edge DecisionDiagram::make_node(int level, Edge e0, Edge e1)
+	{
+		if (is_zero(e0.weight) && is_zero(e1.weight))
+			return { TERMINAL, 0 };
+
+		//Factor out the larger weight, preferring the |0> edge on a tie
+		Complex factor = std::abs(e0.weight) + ComplexTable::TOLERANCE >= std::abs(e1.weight) ? e0.weight : e1.weight;
+
+		Node n;
+		n.level = level;
+		n.weight[0] = complex_.lookup(e0.weight / factor);
+		n.weight[1] = complex_.lookup(e1.weight / factor);
+		n.next[0] = n.weight[0] == ComplexTable::ZERO ? TERMINAL : e0.node;
+		n.next[1] = n.weight[1] == ComplexTable::ZERO ? TERMINAL : e1.node;
+
+		auto it = unique_.find(n);
+		if (it != unique_.end())
+			return { it->second, factor };
+
+		int index = static_cast<int>(nodes_.size());
+		nodes_.push_back(n);
+		unique_.emplace(n, index);
+
+		return { index, factor };
+	}
+
+	DecisionDiagram::Edge DecisionDiagram::add(Edge x, Edge y)
+	{
+		if (is_zero(x.weight))
+			return y;
+		if (is_zero(y.weight))
+			return x;
+
+		//Sums of the same subtree only change its weight
+		if (x.node == y.node)
+		{
+			Complex w = x.weight + y.weight;
+			return is_zero(w) ? Edge{ TERMINAL, 0 } : Edge{ x.node, w };
+		}
+
+		//Factor out x's weight so that the cached sum can be reused at any scale
+		Complex ratio = y.weight / x.weight;
+		SumKey key = { x.node, y.node, complex_.lookup(ratio) };
+
+		auto it = add_table_.find(key);
+		if (it != add_table_.end())
+			return { it->second.node, it->second.weight * x.weight };
+
+		//Nodes are copied as recursion may reallocate the node list
+		Node nx = nodes_[x.node], ny = nodes_[y.node];
+
+		Edge sum0 = add(child(nx, 0), { ny.next[0], complex_[ny.weight[0]] * ratio });
+		Edge sum1 = add(child(nx, 1), { ny.next[1], complex_[ny.weight[1]] * ratio });
+		Edge result = make_node(nx.level, sum0, sum1);
+
+		add_table_.emplace(key, result);
+		return { result.node, result.weight * x.weight };
+	}
+
+	DecisionDiagram::Edge DecisionDiagram::apply_op(const Mat &m, int q, Edge e, std::unordered_map<int, Edge> &cache)
+	{
+		if (is_zero(e.weight))
+			return { TERMINAL, 0 };
+
+		auto it = cache.find(e.node);
+		if (it != cache.end())
+			return { it->second.node, it->second.weight * e.weight };
+
+		Node n = nodes_[e.node];
+		Edge result;
+
+		if (n.level > q)
+		{
+			Edge e0 = apply_op(m, q, child(n, 0), cache);
+			Edge e1 = apply_op(m, q, child(n, 1), cache);
+			result = make_node(n.level, e0, e1);
+		}
+		else
+		{
+			//Mix the two children of qubit q's node
+			Edge c[2] = { child(n, 0), child(n, 1) };
+			Edge out[2];
+
+			for (int r = 0; r < 2; r++)
+				out[r] = add({ c[0].node, c[0].weight * m(r, 0) }, { c[1].node, c[1].weight * m(r, 1) });
+
+			result = make_node(n.level, out[0], out[1]);
+		}
+
+		cache.emplace(e.node, result);
+		return { result.node, result.weight * e.weight };
+	}
+
+	DecisionDiagram::Edge DecisionDiagram::apply_op(const Mat &m, int q, Edge e)
+	{
+		std::unordered_map<int, Edge> cache;
+		return apply_op(m, q, e, cache);
+	}
+
+	double DecisionDiagram::partial_norm(Edge e, const std::vector<int> &need, std::unordered_map<int, double> &cache) const
+	{
+		if (is_absent(e.weight))
+			return 0;
+		if (e.node == TERMINAL)
+			return std::norm(e.weight);
+
+		auto it = cache.find(e.node);
+		if (it != cache.end())
+			return it->second * std::norm(e.weight);
+
+		const Node &n = nodes_[e.node];
+
+		double sum = 0;
+		for (int c = 0; c < 2; c++)
+			if (need[n.level] < 0 || need[n.level] == c)
+				sum += partial_norm(child(n, c), need, cache);
+
+		cache.emplace(e.node, sum);
+		return sum * std::norm(e.weight);
+	}
+
+	double DecisionDiagram::partial_norm(Edge e, const std::vector<int> &need) const
+	{
+		std::unordered_map<int, double> cache;
+		return partial_norm(e, need, cache);
+	}
+
+	Complex DecisionDiagram::inner(Edge x, Edge y, std::unordered_map<std::uint64_t, Complex> &cache) const
+	{
+		if (is_absent(x.weight) || is_absent(y.weight))
+			return 0;
+
+		Complex scale = std::conj(x.weight) * y.weight;
+		if (x.node == TERMINAL)
+			return scale;
+
+		std::uint64_t key = static_cast<std::uint64_t>(x.node) << 32 | static_cast<std::uint32_t>(y.node);
+		auto it = cache.find(key);
+		if (it != cache.end())
+			return it->second * scale;
+
+		const Node &nx = nodes_[x.node], &ny = nodes_[y.node];
+		Complex sum = inner(child(nx, 0), child(ny, 0), cache) + inner(child(nx, 1), child(ny, 1), cache);
+
+		cache.emplace(key, sum);
+		return sum * scale;
+	}
+
+	Complex DecisionDiagram::inner(Edge x, Edge y, const PauliString &p, std::unordered_map<std::uint64_t, Complex> &cache) const
+	{
+		static const Mat IDENTITY = Mat::Identity(2, 2);
+		static const Mat *paulis[] = { &IDENTITY, &PAULI_X, &PAULI_Z, &PAULI_Y };
+
+		if (is_absent(x.weight) || is_absent(y.weight))
+			return 0;
+
+		Complex scale = std::conj(x.weight) * y.weight;
+		if (x.node == TERMINAL)
+			return scale;
+
+		std::uint64_t key = static_cast<std::uint64_t>(x.node) << 32 | static_cast<std::uint32_t>(y.node);
+		auto it = cache.find(key);
+		if (it != cache.end())
+			return it->second * scale;
+
+		//The factor at this level maps y's |c> part to |c ^ flip>, so each part of x
+		//pairs with a single part of y
+		const Node &nx = nodes_[x.node], &ny = nodes_[y.node];
+		const int level = nx.level;
+		const int flip = level < 64 ? static_cast<int>((p.x_mask() >> level) & 1) : 0;
+		const Mat &op = *paulis[level < 64 ? flip | (((p.z_mask() >> level) & 1) << 1) : 0];
+
+		Complex sum = 0;
+		for (int r = 0; r < 2; r++)
+			if (op(r, r ^ flip) != Complex(0))
+				sum += op(r, r ^ flip) * inner(child(nx, r), child(ny, r ^ flip), p, cache);
+
+		cache.emplace(key, sum);
+		return sum * scale;
+	}
+
+	DecisionDiagram::Edge DecisionDiagram::project(Edge e, const std::vector<int> &need, std::unordered_map<int, Edge> &cache)
+	{
+		if (is_absent(e.weight) || e.node == TERMINAL)
+			return e;
+
+		auto it = cache.find(e.node);
+		if (it != cache.end())
+			return { it->second.node, it->second.weight * e.weight };
+
+		Node n = nodes_[e.node];
+		Edge out[2];
+		for (int c = 0; c < 2; c++)
+			out[c] = need[n.level] < 0 || need[n.level] == c ? project(child(n, c), need, cache) : Edge{ TERMINAL, 0 };
+
+		Edge result = make_node(n.level, out[0], out[1]);
+
+		cache.emplace(e.node, result);
+		return { result.node, result.weight * e.weight };
+	}
+
+	void DecisionDiagram::collect_garbage()
+	{
+		if (nodes_.size() < gc_limit_)
+			return;
+
+		//Copy the reachable nodes into fresh tables, children before parents
+		std::vector<Node> old = std::move(nodes_);
+		ComplexTable old_complex = std::move(complex_);
+		std::vector<int> moved(old.size(), -1);
+
+		nodes_.clear();
+		unique_.clear();
+		add_table_.clear();
+		complex_ = ComplexTable();
+
+		nodes_.push_back(old[TERMINAL]);
+		moved[TERMINAL] = TERMINAL;
+
+		std::function<int(int)> copy = [&](int i)
+		{
+			if (moved[i] >= 0)
+				return moved[i];
+
+			Node n = old[i];
+			for (int c = 0; c < 2; c++)
+			{
+				n.next[c] = copy(n.next[c]);
+				n.weight[c] = complex_.lookup(old_complex[n.weight[c]]);
+			}
+
+			moved[i] = static_cast<int>(nodes_.size());
+			nodes_.push_back(n);
+			unique_.emplace(n, moved[i]);
+
+			return moved[i];
+		};
+
+		root_.node = copy(root_.node);
+		gc_limit_ = std::max(MIN_GC_LIMIT, 2 * nodes_.size());
+	}
+
+	void DecisionDiagram::add_qubit()
+	{
+		//The new qubit becomes the root, with the existing diagram as its |0> part
+		root_ = rescale(make_node(count_++, unit_root(), { TERMINAL, 0 }));
+	}
+
+	void DecisionDiagram::reset()
+	{
+		nodes_.clear();
+		unique_.clear();
+		add_table_.clear();
+		complex_ = ComplexTable();
+		nodes_.push_back({ -1, { TERMINAL, TERMINAL }, { ComplexTable::ZERO, ComplexTable::ZERO } });
+
+		root_ = { TERMINAL, 1 };
+		for (int level = 0; level < count_; level++)
+			root_ = make_node(level, root_, { TERMINAL, 0 });
+	}
+
+	void DecisionDiagram::apply(const Mat &m, int q)
+	{
+		root_ = rescale(apply_op(m, q, unit_root()));
+		collect_garbage();
+	}
+
+	void DecisionDiagram::apply(const Mat &m, int a, int b)
+	{
+		//Decompose m as the sum over i, j of |i><j| on a and the 2x2 block m_ij on b
+		Edge sum = { TERMINAL, 0 };
+		for (int i = 0; i < 2; i++)
+			for (int j = 0; j < 2; j++)
+			{
+				Mat block = m.block(2 * i, 2 * j, 2, 2);
+				if (block.isZero())
+					continue;
+
+				Mat transition = Mat::Zero(2, 2);
+				transition(i, j) = 1;
+
+				sum = add(sum, apply_op(block, b, apply_op(transition, a, unit_root())));
+			}
+
+		root_ = rescale(sum);
+		collect_garbage();
+	}
+
+	void DecisionDiagram::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//Unravel the channel: pick one Kraus operator with probability ||K|psi>||^2
+		const std::vector<int> none(count_, -1);
+		double u = rng.uniform();
+
+		Edge chosen = root_;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			Edge candidate = rescale(apply_op(kraus[k], q, unit_root()));
+			double pk = partial_norm(candidate, none);
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = candidate;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		root_ = { chosen.node, chosen.weight / std::sqrt(p) };
+		collect_garbage();
+	}
+
+	double DecisionDiagram::probability(int q) const
+	{
+		std::vector<int> need(count_, -1);
+		need[q] = 1;
+
+		return partial_norm(root_, need);
+	}
+
+	double DecisionDiagram::probability(Bitstring outcome) const
+	{
+		//Follow the single path of the outcome, multiplying its weights
+		Edge e = root_;
+		Complex amplitude = 1;
+		while (e.node != TERMINAL && !is_absent(e.weight))
+		{
+			const Node &n = nodes_[e.node];
+			amplitude *= e.weight;
+			e = child(n, n.level < 64 ? static_cast<int>((outcome >> n.level) & 1) : 0);
+		}
+
+		return std::norm(amplitude * e.weight);
+	}
+
+	std::vector<double> DecisionDiagram::marginal(const std::vector<int> &indices) const
+	{
+		std::vector<double> prob(Bitstring(1) << indices.size());
+		std::vector<int> need(count_, -1);
+
+		for (Bitstring o = 0; o < prob.size(); o++)
+		{
+			for (std::size_t j = 0; j < indices.size(); j++)
+				need[indices[j]] = static_cast<int>((o >> j) & 1);
+
+			prob[o] = partial_norm(root_, need);
+		}
+
+		return prob;
+	}
+
+	void DecisionDiagram::collapse(const std::vector<int> &indices, Bitstring outcome, double)
+	{
+		std::vector<int> need(count_, -1);
+		for (std::size_t j = 0; j < indices.size(); j++)
+			need[indices[j]] = static_cast<int>((outcome >> j) & 1);
+
+		std::unordered_map<int, Edge> cache;
+		root_ = project(root_, need, cache);
+
+		//Renormalise by the projected norm itself rather than the given probability
+		double norm = partial_norm(root_, std::vector<int>(count_, -1));
+		root_.weight /= std::sqrt(norm);
+
+		collect_garbage();
+	}
+
+	Bitstring DecisionDiagram::measure(const std::vector<int> &indices)
+	{
+		//Measuring one qubit after another draws from the joint distribution
+		//without enumerating its 2^k outcomes
+		Bitstring outcome = 0;
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			Bitstring b = chance(probability(indices[j])) ? 1 : 0;
+			collapse({ indices[j] }, b, 0);
+			outcome |= b << j;
+		}
+
+		return outcome;
+	}
+
+	std::vector<Bitstring> DecisionDiagram::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		//Squared norm below each node, shared by every shot
+		const std::vector<int> none(count_, -1);
+		std::unordered_map<int, double> norms;
+		partial_norm(root_, none, norms);
+
+		auto norm_of = [&](Edge e)
+		{
+			if (is_absent(e.weight))
+				return 0.0;
+			return std::norm(e.weight) * (e.node == TERMINAL ? 1.0 : norms[e.node]);
+		};
+
+		//Descend from the root, choosing each child in proportion to its norm
+		std::vector<Bitstring> results(shots);
+		for (unsigned shot = 0; shot < shots; shot++)
+		{
+			Bitstring bits = 0;
+			for (Edge e = root_; e.node != TERMINAL; )
+			{
+				const Node &n = nodes_[e.node];
+				Edge e0 = child(n, 0), e1 = child(n, 1);
+				double p0 = norm_of(e0), p1 = norm_of(e1);
+
+				bool one = rng.uniform() * (p0 + p1) < p1;
+				if (one && n.level < 64)
+					bits |= Bitstring(1) << n.level;
+
+				e = one ? e1 : e0;
+			}
+
+			results[shot] = gather_bits(static_cast<Eigen::Index>(bits), indices);
+		}
+
+		return results;
+	}
+
+	double DecisionDiagram::expectation(const PauliString &p) const
+	{
+		//P is applied during the walk, so no nodes are built and the diagram is not copied
+		std::unordered_map<std::uint64_t, Complex> cache;
+		return inner(root_, root_, p, cache).real();
+	}
+
+	void DecisionDiagram::print(std::ostream &os, int count) const
+	{
+		//Print each nonzero coefficient, visiting |0> children first to keep basis order
+		std::function<void(Edge, Bitstring, Complex)> visit = [&](Edge e, Bitstring index, Complex amplitude)
+		{
+			if (is_absent(e.weight))
+				return;
+
+			amplitude *= e.weight;
+			if (e.node == TERMINAL)
+			{
+				//Format basis vector as binary number
+				os << "|";
+				for (int j = count; j > 0; j--)
+					os << ((index >> (j-1)) & 1);
+				os << "> ";
+
+				print_complex(os, amplitude);
+				os << std::endl;
+				return;
+			}
+
+			const Node &n = nodes_[e.node];
+			visit(child(n, 0), index, amplitude);
+			visit(child(n, 1), index | Bitstring(1) << n.level, amplitude);
+		};
+
+		visit(root_, 0, 1);
+	}
+
+	BackendReport DecisionDiagram::report() const
+	{
+		double memory = nodes_.size() * sizeof(Node) + complex_.size() * sizeof(Complex);
+		return { Backend::DecisionDiagram, memory, static_cast<double>(nodes_.size()), "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> DecisionDiagram::fork() const
+	{
+		return std::make_unique<DecisionDiagram>(*this);
+	}
+}
@@ -0,0 +1,170 @@
+/**
+ * @file DecisionDiagram.h
+ *
+ * Internal header defining the decision diagram backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+#include <unordered_map>
+
+namespace qlay
+{
+	//Deduplicates complex numbers equal to within a tolerance, so that
+	//decision diagram nodes differing only by rounding are shared
+	class ComplexTable
+	{
+	private:
+		std::vector<Complex> values_;
+		std::unordered_map<std::uint64_t, int> cells_;
+
+		//Returns the key of the grid cell holding the given coordinates
+		static std::uint64_t cell(long long re, long long im)
+		{
+			return static_cast<std::uint64_t>(re) * 0x9e3779b97f4a7c15ULL ^ static_cast<std::uint64_t>(im);
+		}
+
+	public:
+		//Values closer than this in both parts are considered equal
+		static constexpr double TOLERANCE = 1e-13;
+
+		//Index of zero and one, which are always present
+		static constexpr int ZERO = 0;
+		static constexpr int ONE = 1;
+
+		ComplexTable();
+
+		//Returns the index of a value equal to c, adding it if necessary
+		int lookup(Complex c);
+
+		//Returns the value at the given index
+		Complex operator[](int i) const { return values_[i]; }
+
+		//Returns the number of values stored
+		std::size_t size() const { return values_.size(); }
+	};
+
+	//Quantum multiple-valued decision diagram: a vector is a tree with one level
+	//per qubit, its amplitudes the products of edge weights along each path.
+	//Identical subtrees are shared through a unique table, so structured states
+	//can take exponentially less memory than a dense vector.
+	class DecisionDiagram : public State
+	{
+	private:
+		//Weighted edge into a node; a zero weight edge always points at the terminal
+		struct Edge
+		{
+			int node;
+			Complex weight;
+		};
+
+		//Node at the level of one qubit, with children for its |0> and |1> parts.
+		//Weights are normalised so that the larger has magnitude one.
+		struct Node
+		{
+			int level;
+			int next[2];
+			int weight[2]; //Indices into the complex table
+		};
+
+		struct NodeHash
+		{
+			std::size_t operator()(const Node &n) const;
+		};
+
+		struct NodeEqual
+		{
+			bool operator()(const Node &a, const Node &b) const;
+		};
+
+		//Key of a sum x + r y of two unit-weight edges, with r indexed in the complex table
+		struct SumKey
+		{
+			int x, y, ratio;
+
+			bool operator==(const SumKey &o) const { return x == o.x && y == o.y && ratio == o.ratio; }
+		};
+
+		struct SumHash
+		{
+			std::size_t operator()(const SumKey &k) const;
+		};
+
+		//Index of the terminal node, below level 0
+		static constexpr int TERMINAL = 0;
+
+		std::vector<Node> nodes_;
+		std::unordered_map<Node, int, NodeHash, NodeEqual> unique_;
+		ComplexTable complex_;
+
+		//Compute table of sums, keyed by both nodes and the ratio of their weights
+		std::unordered_map<SumKey, Edge, SumHash> add_table_;
+
+		//The root weight carries the global normalisation, so may be far below the tolerance
+		//of the complex table; operations building nodes start from unit_root() instead
+		Edge root_;
+		int count_ = 0;
+		std::size_t gc_limit_;
+
+		//Returns the edge to the given child of a node
+		Edge child(const Node &n, int c) const { return { n.next[c], complex_[n.weight[c]] }; }
+
+		//Returns the root with unit weight, and the result of an operation on it rescaled by the root weight
+		Edge unit_root() const { return { root_.node, 1 }; }
+		Edge rescale(Edge e) const { return { e.node, e.weight * root_.weight }; }
+
+		//Returns the shared node with the given children, normalised, and the weight factored out of them
+		Edge make_node(int level, Edge e0, Edge e1);
+
+		//Returns the diagram of the sum of two diagrams at the same level
+		Edge add(Edge x, Edge y);
+
+		//Returns the diagram after applying the 2x2 operator m to qubit q, memoised per node
+		Edge apply_op(const Mat &m, int q, Edge e, std::unordered_map<int, Edge> &cache);
+		Edge apply_op(const Mat &m, int q, Edge e);
+
+		//Returns the squared norm of the part of the diagram where each qubit i with
+		//need[i] >= 0 has that value, memoised per node
+		double partial_norm(Edge e, const std::vector<int> &need, std::unordered_map<int, double> &cache) const;
+		double partial_norm(Edge e, const std::vector<int> &need) const;
+
+		//Returns <x|y>, memoised per pair of nodes
+		Complex inner(Edge x, Edge y, std::unordered_map<std::uint64_t, Complex> &cache) const;
+
+		//Returns <x|P|y>, applying each factor of the Pauli string as its level is reached,
+		//memoised per pair of nodes
+		Complex inner(Edge x, Edge y, const PauliString &p, std::unordered_map<std::uint64_t, Complex> &cache) const;
+
+		//Returns the diagram with every qubit i with need[i] >= 0 projected onto that value
+		Edge project(Edge e, const std::vector<int> &need, std::unordered_map<int, Edge> &cache);
+
+		//Rebuilds the tables from the nodes reachable from the root once they have outgrown the limit
+		void collect_garbage();
+
+	public:
+		DecisionDiagram();
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+	};
+}
@@ -0,0 +1,163 @@
+/**
+ * @file DensityMatrix.cpp
+ *
+ * Implements the density matrix backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "DensityMatrix.h"
+#include "StateVector.h"
+
+namespace qlay
+{
+	void DensityMatrix::add_qubit()
+	{
+		//|0><0| (x) rho occupies the top-left quadrant
+		if (count_++ == 0)
+			rho_ = ZERO * ZERO.adjoint();
+		else
+		{
+			Eigen::Index size = rho_.rows();
+			Mat grown = Mat::Zero(2 * size, 2 * size);
+			grown.topLeftCorner(size, size) = rho_;
+			rho_.swap(grown);
+		}
+	}
+
+	void DensityMatrix::reset()
+	{
+		if (count_ == 0)
+			return;
+
+		rho_.setZero();
+		rho_(0, 0) = 1;
+	}
+
+	void DensityMatrix::apply(const Mat &m, int q)
+	{
+		apply_kernel(rho_.data(), rho_.size(), m, q);
+		apply_kernel(rho_.data(), rho_.size(), m.conjugate(), q + count_);
+	}
+
+	void DensityMatrix::apply(const Mat &m, int a, int b)
+	{
+		apply_kernel(rho_.data(), rho_.size(), m, a, b);
+		apply_kernel(rho_.data(), rho_.size(), m.conjugate(), a + count_, b + count_);
+	}
+
+	void DensityMatrix::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//rho' = sum of K rho K^dagger
+		Mat result = Mat::Zero(rho_.rows(), rho_.cols());
+
+		for (const Mat &k : kraus)
+		{
+			Mat term = rho_;
+			apply_kernel(term.data(), term.size(), k, q);
+			apply_kernel(term.data(), term.size(), k.conjugate(), q + count_);
+			result += term;
+		}
+
+		rho_.swap(result);
+	}
+
+	void DensityMatrix::apply_pauli_channel(double px, double py, double pz, int q)
+	{
+		check_pauli_probabilities(px, py, pz);
+
+		//Mix exactly rather than sampling
+		apply_channel({
+			std::sqrt(std::max(0.0, 1 - px - py - pz)) * Mat::Identity(2, 2),
+			std::sqrt(px) * PAULI_X,
+			std::sqrt(py) * PAULI_Y,
+			std::sqrt(pz) * PAULI_Z
+		}, q);
+	}
+
+	double DensityMatrix::probability(int q) const
+	{
+		Eigen::Index mask = Eigen::Index(1) << q;
+
+		double p = 0;
+		for (Eigen::Index i = 0; i < rho_.rows(); i++)
+			if (i & mask)
+				p += rho_(i, i).real();
+
+		return p;
+	}
+
+	double DensityMatrix::probability(Bitstring outcome) const
+	{
+		Eigen::Index i = static_cast<Eigen::Index>(outcome);
+		return rho_(i, i).real();
+	}
+
+	std::vector<double> DensityMatrix::marginal(const std::vector<int> &indices) const
+	{
+		return marginalise(rho_.rows(), indices, [this](Eigen::Index i) { return rho_(i, i).real(); });
+	}
+
+	void DensityMatrix::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		//Keep only the block where both row and column agree with the outcome
+		#pragma omp parallel for if(rho_.size() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index c = 0; c < rho_.cols(); c++)
+		{
+			bool keep_c = gather_bits(c, indices) == outcome;
+
+			for (Eigen::Index r = 0; r < rho_.rows(); r++)
+				rho_(r, c) = keep_c && gather_bits(r, indices) == outcome ? rho_(r, c) / p : Complex(0);
+		}
+	}
+
+	double DensityMatrix::expectation(const PauliString &p) const
+	{
+		Bitstring x = p.x_mask();
+		Bitstring z = p.z_mask();
+
+		//Tr(rho P) = i^(#Y) sum_j (-1)^(popcount(j & z)) rho(j, j ^ x)
+		double re = 0, im = 0;
+		#pragma omp parallel for reduction(+:re,im) if(rho_.rows() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index j = 0; j < rho_.rows(); j++)
+		{
+			Complex term = rho_(j, static_cast<Eigen::Index>(j ^ x));
+			if (parity(j & z))
+				term = -term;
+
+			re += term.real();
+			im += term.imag();
+		}
+
+		return (pauli_phase(p) * Complex(re, im)).real();
+	}
+
+	void DensityMatrix::print(std::ostream &os, int count) const
+	{
+		auto basis = [&](Eigen::Index i)
+		{
+			for (int j = count; j > 0; j--)
+				os << ((i >> (j-1)) & 1);
+		};
+
+		//Print each element as |row><col| coefficient
+		for (Eigen::Index r = 0; r < rho_.rows(); r++)
+			for (Eigen::Index c = 0; c < rho_.cols(); c++)
+			{
+				os << "|"; basis(r); os << "><"; basis(c); os << "| ";
+				print_complex(os, rho_(r, c));
+				os << std::endl;
+			}
+	}
+
+	BackendReport DensityMatrix::report() const
+	{
+		double size = static_cast<double>(rho_.size());
+		return { Backend::DensityMatrix, size * sizeof(Complex), 2 * size, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> DensityMatrix::fork() const
+	{
+		return std::make_unique<DensityMatrix>(*this);
+	}
+}
@@ -0,0 +1,49 @@
+/**
+ * @file DensityMatrix.h
+ *
+ * Internal header defining the density matrix backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+namespace qlay
+{
+	//Mixed state held as a 2^n x 2^n density matrix. Operators act on the
+	//column-major storage as a 2n-qubit vector: U on row bit q and conj(U)
+	//on column bit n+q gives U rho U^dagger without forming any 4^n operator.
+	class DensityMatrix : public State
+	{
+	private:
+		Mat rho_;
+		int count_ = 0;
+
+	public:
+		//References the Eigen density matrix
+		Mat &get() { return rho_; }
+		const Mat &get() const { return rho_; }
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+		void apply_pauli_channel(double px, double py, double pz, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override { return measure_marginal(indices); }
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override { return sample_marginal(shots, indices); }
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+	};
+}
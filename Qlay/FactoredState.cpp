@@ -0,0 +1,238 @@
+/**
+ * @file FactoredState.cpp
+ *
+ * Implements the factored state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "FactoredState.h"
+
+namespace qlay
+{
+	void FactoredState::add_group(int q, int bit)
+	{
+		group_[q] = static_cast<int>(groups_.size());
+		local_[q] = 0;
+		groups_.push_back({ StateVector(bit ? ONE : ZERO, 1), { q } });
+	}
+
+	void FactoredState::remove_group(int g)
+	{
+		if (g != static_cast<int>(groups_.size()) - 1)
+		{
+			groups_[g] = std::move(groups_.back());
+			for (int q : groups_[g].qubits)
+				group_[q] = g;
+		}
+
+		groups_.pop_back();
+	}
+
+	int FactoredState::merge(int a, int b)
+	{
+		int ga = group_[a], gb = group_[b];
+		if (ga == gb)
+			return ga;
+
+		//The qubits of b's group become the high-order bits
+		Group &low = groups_[ga];
+		Group &high = groups_[gb];
+		int shift = static_cast<int>(low.qubits.size());
+
+		Ket v = kronecker_product(high.state.get(), low.state.get());
+		for (int q : high.qubits)
+		{
+			low.qubits.push_back(q);
+			group_[q] = ga;
+			local_[q] += shift;
+		}
+
+		low.state = StateVector(std::move(v), static_cast<int>(low.qubits.size()));
+		remove_group(gb);
+
+		return group_[a];
+	}
+
+	void FactoredState::split(int q, int bit)
+	{
+		Group &g = groups_[group_[q]];
+		if (g.qubits.size() == 1)
+			return;
+
+		//Keep the half of the amplitudes where q has the given value
+		const int l = local_[q];
+		const Ket &v = g.state.get();
+		const Eigen::Index offset = Eigen::Index(bit) << l;
+
+		Ket rest(v.size() / 2);
+		for (Eigen::Index j = 0; j < rest.size(); j++)
+			rest(j) = v(insert_zero(j, l) | offset);
+
+		g.qubits.erase(g.qubits.begin() + l);
+		for (int i = l; i < static_cast<int>(g.qubits.size()); i++)
+			local_[g.qubits[i]] = i;
+
+		g.state = StateVector(std::move(rest), static_cast<int>(g.qubits.size()));
+		add_group(q, bit);
+	}
+
+	void FactoredState::localise(const std::vector<int> &indices, std::vector<int> &groups,
+		std::vector<std::vector<int>> &local, std::vector<std::vector<int>> &positions) const
+	{
+		std::vector<int> slot(groups_.size(), -1);
+
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			int g = group_[indices[j]];
+			if (slot[g] < 0)
+			{
+				slot[g] = static_cast<int>(groups.size());
+				groups.push_back(g);
+				local.emplace_back();
+				positions.emplace_back();
+			}
+
+			local[slot[g]].push_back(local_[indices[j]]);
+			positions[slot[g]].push_back(static_cast<int>(j));
+		}
+	}
+
+	void FactoredState::add_qubit()
+	{
+		group_.push_back(0);
+		local_.push_back(0);
+		add_group(static_cast<int>(group_.size()) - 1, 0);
+	}
+
+	void FactoredState::reset()
+	{
+		groups_.clear();
+		for (int q = 0; q < static_cast<int>(group_.size()); q++)
+			add_group(q, 0);
+	}
+
+	void FactoredState::apply(const Mat &m, int q)
+	{
+		groups_[group_[q]].state.apply(m, local_[q]);
+	}
+
+	void FactoredState::apply(const Mat &m, int a, int b)
+	{
+		//Only a gate acting across two groups requires their product to be formed
+		int g = merge(a, b);
+		groups_[g].state.apply(m, local_[a], local_[b]);
+	}
+
+	void FactoredState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		groups_[group_[q]].state.apply_channel(kraus, local_[q]);
+	}
+
+	double FactoredState::probability(int q) const
+	{
+		return groups_[group_[q]].state.probability(local_[q]);
+	}
+
+	double FactoredState::probability(Bitstring outcome) const
+	{
+		double p = 1;
+		for (const Group &g : groups_)
+			p *= g.state.probability(gather_bits(static_cast<Eigen::Index>(outcome), g.qubits));
+
+		return p;
+	}
+
+	std::vector<double> FactoredState::marginal(const std::vector<int> &indices) const
+	{
+		std::vector<int> groups;
+		std::vector<std::vector<int>> local, positions;
+		localise(indices, groups, local, positions);
+
+		//Groups are independent, so the joint distribution is the product of theirs
+		std::vector<std::vector<double>> parts(groups.size());
+		for (std::size_t i = 0; i < groups.size(); i++)
+			parts[i] = groups_[groups[i]].state.marginal(local[i]);
+
+		std::vector<double> prob(Bitstring(1) << indices.size());
+		for (Bitstring o = 0; o < prob.size(); o++)
+		{
+			double p = 1;
+			for (std::size_t i = 0; i < groups.size(); i++)
+				p *= parts[i][gather_bits(static_cast<Eigen::Index>(o), positions[i])];
+
+			prob[o] = p;
+		}
+
+		return prob;
+	}
+
+	void FactoredState::collapse(const std::vector<int> &indices, Bitstring outcome, double)
+	{
+		std::vector<int> groups;
+		std::vector<std::vector<int>> local, positions;
+		localise(indices, groups, local, positions);
+
+		//Collapse each group onto its share of the outcome, with its own probability
+		for (std::size_t i = 0; i < groups.size(); i++)
+		{
+			StateVector &s = groups_[groups[i]].state;
+			Bitstring part = gather_bits(static_cast<Eigen::Index>(outcome), positions[i]);
+			s.collapse(local[i], part, s.marginal(local[i])[part]);
+		}
+
+		//Measured qubits are no longer entangled with anything, so split them out
+		for (std::size_t j = 0; j < indices.size(); j++)
+			split(indices[j], static_cast<int>((outcome >> j) & 1));
+	}
+
+	double FactoredState::expectation(const PauliString &p) const
+	{
+		//The expectation of a product over independent groups is the product of expectations
+		double e = 1;
+		for (const Group &g : groups_)
+		{
+			Bitstring x = gather_bits(static_cast<Eigen::Index>(p.x_mask()), g.qubits);
+			Bitstring z = gather_bits(static_cast<Eigen::Index>(p.z_mask()), g.qubits);
+
+			if (x || z)
+				e *= g.state.expectation(PauliString(x, z));
+		}
+
+		return e;
+	}
+
+	void FactoredState::print(std::ostream &os, int count) const
+	{
+		//Expand the product into a single state vector
+		Ket v(Eigen::Index(1) << count);
+		for (Eigen::Index i = 0; i < v.size(); i++)
+		{
+			Complex a = 1;
+			for (const Group &g : groups_)
+				a *= g.state.amplitude(static_cast<Eigen::Index>(gather_bits(i, g.qubits)));
+
+			v(i) = a;
+		}
+
+		StateVector(std::move(v), count).print(os, count);
+	}
+
+	BackendReport FactoredState::report() const
+	{
+		double amplitudes = 0, largest = 0;
+		for (const Group &g : groups_)
+		{
+			double size = static_cast<double>(g.state.size());
+			amplitudes += size;
+			largest = std::max(largest, size);
+		}
+
+		return { Backend::Factored, amplitudes * sizeof(Complex), largest, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> FactoredState::fork() const
+	{
+		return std::make_unique<FactoredState>(*this);
+	}
+}
@@ -0,0 +1,71 @@
+/**
+ * @file FactoredState.h
+ *
+ * Internal header defining the factored state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "StateVector.h"
+
+namespace qlay
+{
+	//Product of independent state vectors, each holding a group of qubits which
+	//may be entangled with one another but not with other groups. Groups are
+	//merged by a two-qubit gate acting across them and measured qubits are split
+	//back out, so unentangled qubits cost 2 amplitudes each rather than doubling
+	//the size of one global vector.
+	class FactoredState : public State
+	{
+	private:
+		//A sub-state whose bit i is the qubit qubits[i]
+		struct Group
+		{
+			StateVector state;
+			std::vector<int> qubits;
+		};
+
+		std::vector<Group> groups_;
+		std::vector<int> group_; //Group holding each qubit
+		std::vector<int> local_; //Bit of each qubit within its group
+
+		//Appends a group holding the given qubit alone in the given basis state
+		void add_group(int q, int bit);
+
+		//Removes the group at the given position, renumbering the last group in its place
+		void remove_group(int g);
+
+		//Merges the groups of qubits a and b, returning the merged group
+		int merge(int a, int b);
+
+		//Moves a qubit known to be in the given basis state out into a group of its own
+		void split(int q, int bit);
+
+		//Partitions the given qubits by group, listing each group touched along with
+		//the local bits of its qubits and their positions within indices
+		void localise(const std::vector<int> &indices, std::vector<int> &groups,
+			std::vector<std::vector<int>> &local, std::vector<std::vector<int>> &positions) const;
+
+	public:
+		FactoredState() = default;
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+	};
+}
@@ -6,10 +6,11 @@
  * @author Sam Griffiths
  */
 
-#include "Core.h"
+#include "Circuit.h"
 
-#include <set>
 #include <algorithm>
+#include <numeric>
+#include <stdexcept>
 
 namespace qlay
 {
@@ -92,43 +93,27 @@ namespace qlay
 			                           0, 0, 1, 0).finished();
 	}
 
-	//Expands the given operator matrix to apply to a given qubit
-	Mat expand_operator(const Mat &m, int count, int index)
-	{
-		Mat result(1, 1);
-		result << 1;
-
-		for (int i = 0; i < index; i++)
-			result = kronecker_product(matrices::I, result);
-
-		result = kronecker_product(m, result);
-
-		//Reduce expansion if matrix is already two-input
-		int limit = m.rows() == 4 ? count - 2 : count - 1;
-
-		for (int i = index; i < limit; i++)
-			result = kronecker_product(matrices::I, result);
-
-		return result;
-	}
-
-
 	//Quantum logic gate functor
 	class Gate
 	{
 	private:
+		Op op_;
 		Mat m_;
 
 	public:
-		Gate(Mat m) : m_(m)
+		Gate(Op op, Mat m) : op_(op), m_(m)
 		{
 		}
 
 		void operator()(const Qubit &q) const
 		{
-			Ket &state = q.system().state_->get();
-			Mat op = expand_operator(m_, q.system().count(), q.index());
-			state = op * state;
+			q.system().state_->apply(m_, q.index());
+			q.system().apply_noise(q.index());
+		}
+
+		void operator()(Circuit &c, int q) const
+		{
+			c.program_->record({ op_, 0, q, -1, m_ });
 		}
 	};
 
@@ -136,18 +121,23 @@ namespace qlay
 	class AngleGate
 	{
 	private:
+		Op op_;
 		std::function<Mat(double)> m_;
 
 	public:
-		AngleGate(std::function<Mat(double)> m) : m_(m)
+		AngleGate(Op op, std::function<Mat(double)> m) : op_(op), m_(m)
 		{
 		}
 
 		void operator()(double angle, const Qubit &q) const
 		{
-			Ket &state = q.system().state_->get();
-			Mat op = expand_operator(m_(angle), q.system().count(), q.index());
-			state = op * state;
+			q.system().state_->apply(m_(angle), q.index());
+			q.system().apply_noise(q.index());
+		}
+
+		void operator()(double angle, Circuit &c, int q) const
+		{
+			c.program_->record({ op_, angle, q, -1, m_(angle) });
 		}
 	};
 
@@ -155,80 +145,59 @@ namespace qlay
 	class TwoGate
 	{
 	private:
+		Op op_;
 		Mat m_;
 
 	public:
-		TwoGate(Mat m) : m_(m)
+		TwoGate(Op op, Mat m) : op_(op), m_(m)
 		{
 		}
 
 		void operator()(const Qubit &a, const Qubit &b) const
 		{
+			//Backends apply the operator in place on any pair, with a as the high-order input
 			QubitSystem &qs = b.system();
-			Ket &state = qs.state_->get();
-
-			//If the qubits are consecutive and correctly ordered, apply normally
-			if (a.index() == b.index() + 1)
-			{
-				Mat op = expand_operator(m_, qs.count(), b.index());
-				state = op * state;
-			}
-
-			//If the qubits are consecutive but incorrectly ordered, swap before and after
-			else if (a.index() == b.index() - 1)
-			{
-				SWAP(b, a);
-				Mat op = expand_operator(m_, qs.count(), a.index());
-				state = op * state;
-				SWAP(b, a);
-			}
-
-			//If the qubits are nonconsecutive, swap into end position
-			else
-			{
-				//Swap b into end (q0 position)
-				for (int i = b.index(); i > 0; i--)
-					SWAP(Qubit(qs, i), Qubit(qs, i - 1));
-
-				//a may have been displaced
-				int a_i = a.index() < b.index() ? a.index() + 1 : a.index();
-
-				//Swap a into end-but-one (q1 position)
-				for (int i = a_i; i > 1; i--)
-					SWAP(Qubit(qs, i), Qubit(qs, i - 1));
-
-				//Apply operator to end
-				Mat op = expand_operator(m_, qs.count(), 0);
-				state = op * state;
-
-				//Swap a back
-				for (int i = 1; i < a_i; i++)
-					SWAP(Qubit(qs, i + 1), Qubit(qs, i));
-
-				//Swap b back
-				for (int i = 0; i < b.index(); i++)
-					SWAP(Qubit(qs, i + 1), Qubit(qs, i));
-			}
+			qs.state_->apply(m_, a.index(), b.index());
+			qs.apply_noise(a.index());
+			qs.apply_noise(b.index());
+		}
+
+		void operator()(Circuit &c, int a, int b) const
+		{
+			c.program_->record({ op_, 0, a, b, m_ });
 		}
 	};
 
 
+	Mat rotation(Op op, double angle)
+	{
+		switch (op)
+		{
+		case Op::Rx: return matrices::Rx(angle);
+		case Op::Ry: return matrices::Ry(angle);
+		case Op::Rz: return matrices::Rz(angle);
+		case Op::Rp: return matrices::Rp(angle);
+		default:     throw std::invalid_argument("Operation is not a rotation");
+		}
+	}
+
+
 	namespace gates
 	{
-		const Gate X(matrices::X);
-		const Gate Y(matrices::Y);
-		const Gate Z(matrices::Z);
-		const Gate H(matrices::H);
-		const Gate SRNOT(matrices::SRNOT);
-
-		const AngleGate Rx(matrices::Rx);
-		const AngleGate Ry(matrices::Ry);
-		const AngleGate Rz(matrices::Rz);
-		const AngleGate Rp(matrices::Rp);
-
-		const TwoGate SWAP(matrices::SWAP);
-		const TwoGate SRSWAP(matrices::SRSWAP);
-		const TwoGate CNOT(matrices::CNOT);
+		const Gate X(Op::X, matrices::X);
+		const Gate Y(Op::Y, matrices::Y);
+		const Gate Z(Op::Z, matrices::Z);
+		const Gate H(Op::H, matrices::H);
+		const Gate SRNOT(Op::SRNOT, matrices::SRNOT);
+
+		const AngleGate Rx(Op::Rx, matrices::Rx);
+		const AngleGate Ry(Op::Ry, matrices::Ry);
+		const AngleGate Rz(Op::Rz, matrices::Rz);
+		const AngleGate Rp(Op::Rp, matrices::Rp);
+
+		const TwoGate SWAP(Op::SWAP, matrices::SWAP);
+		const TwoGate SRSWAP(Op::SRSWAP, matrices::SRSWAP);
+		const TwoGate CNOT(Op::CNOT, matrices::CNOT);
 	}
 
 	inline void X(const Qubit &q) { return gates::X(q); }
@@ -246,54 +215,33 @@ namespace qlay
 	inline void SRSWAP(const Qubit &a, const Qubit &b) { return gates::SRSWAP(a, b); }
 	inline void CNOT(const Qubit &control, const Qubit &target) { return gates::CNOT(control, target); }
 
+	inline void X(Circuit &c, int q) { return gates::X(c, q); }
+	inline void Y(Circuit &c, int q) { return gates::Y(c, q); }
+	inline void Z(Circuit &c, int q) { return gates::Z(c, q); }
+	inline void H(Circuit &c, int q) { return gates::H(c, q); }
+	inline void SRNOT(Circuit &c, int q) { return gates::SRNOT(c, q); }
 
-	//Returns a set of numbers below the upper bound x with bit b as value (default true)
-	template <typename T, typename U>
-	std::set<T> ints_with_bit(T x, U b, bool value = true)
-	{
-		static_assert(std::is_integral<T>::value, "Upper bound must be integer");
-		static_assert(std::is_integral<U>::value, "Bit index must be integer");
-
-		std::set<T> s;
-		T mask = 1 << b;
+	inline void Rx(double angle, Circuit &c, int q) { return gates::Rx(angle, c, q); }
+	inline void Ry(double angle, Circuit &c, int q) { return gates::Ry(angle, c, q); }
+	inline void Rz(double angle, Circuit &c, int q) { return gates::Rz(angle, c, q); }
+	inline void Rp(double angle, Circuit &c, int q) { return gates::Rp(angle, c, q); }
 
-		for (T i = 0; i < x; i++)
-			if (static_cast<bool>(i & mask) == value)
-				s.insert(i);
+	inline void SWAP(Circuit &c, int a, int b) { return gates::SWAP(c, a, b); }
+	inline void SRSWAP(Circuit &c, int a, int b) { return gates::SRSWAP(c, a, b); }
+	inline void CNOT(Circuit &c, int control, int target) { return gates::CNOT(c, control, target); }
 
-		return s;
-	}
 
 	Basis M(const Qubit &q)
 	{
-		//Set of coefficient indices where qx = |1>
-		auto s = ints_with_bit(1 << q.system().count(), q.index());
+		State &state = *q.system().state_;
 
-		//Set complement
-		auto sc = ints_with_bit(1 << q.system().count(), q.index(), false);
-
-		Ket &state = q.system().state_->get();
-
-		//Sum individual probabilities
-		double p = 0;
-		for (auto i : s)
-			p += std::norm(state(i));
+		//Probability of measuring |1>
+		double p = state.probability(q.index());
 
 		bool result = chance(std::clamp(p, 0.0, 1.0));
 
-		//Set contradictory states to zero
-		for (auto i : (result ? sc : s))
-			state(i) = 0;
-
-		//Initialise then sum normalisation constant
-		double norm = 0;
-		for (auto i : (result ? s : sc))
-			norm += std::norm(state(i));
-
-		//Renormalise states
-		norm = std::sqrt(norm);
-		for (auto i : (result ? s : sc))
-			state(i) /= norm;
+		//Set contradictory states to zero and renormalise
+		state.collapse({ q.index() }, result, result ? p : 1 - p);
 
 		return result;
 	}
@@ -311,4 +259,73 @@ namespace qlay
 
 		return result;
 	}
+
+	void M(Circuit &c, int q)
+	{
+		c.program_->record({ Op::M, 0, q, -1, Mat() });
+	}
+
+	void Mx(Circuit &c, int q)
+	{
+		H(c, q);
+		M(c, q);
+		H(c, q);
+	}
+
+	Bitstring M(QubitSystem &qs)
+	{
+		std::vector<int> indices(qs.count());
+		std::iota(indices.begin(), indices.end(), 0);
+
+		return M(qs, indices);
+	}
+
+	Bitstring M(QubitSystem &qs, const std::vector<int> &indices)
+	{
+		check_register(indices, qs.count());
+		return qs.state_->measure(indices);
+	}
+
+	Bitstring State::measure(const std::vector<int> &indices)
+	{
+		//Measuring one qubit after another draws from the joint distribution
+		//without enumerating its 2^k outcomes
+		Bitstring outcome = 0;
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			double p = std::clamp(probability(indices[j]), 0.0, 1.0);
+			Bitstring b = chance(p) ? 1 : 0;
+
+			collapse({ indices[j] }, b, b ? p : 1 - p);
+			outcome |= b << j;
+		}
+
+		return outcome;
+	}
+
+	Bitstring State::measure_marginal(const std::vector<int> &indices)
+	{
+		//Marginal probability of each joint outcome, in a single pass
+		std::vector<double> p = marginal(indices);
+
+		//Draw one joint outcome from the cumulative distribution
+		double u = rng.uniform();
+
+		Bitstring result = 0;
+		for (double acc = 0; result < p.size() - 1; result++)
+		{
+			acc += p[result];
+			if (u < acc && p[result] > 0)
+				break;
+		}
+
+		//Walk back over any trailing impossible outcomes left by rounding
+		while (result > 0 && p[result] == 0)
+			result--;
+
+		//Collapse and renormalise in a single further pass
+		collapse(indices, result, p[result]);
+
+		return result;
+	}
 }
@@ -0,0 +1,395 @@
+/**
+ * @file HybridState.cpp
+ *
+ * Implements the Schrödinger-Feynman hybrid backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "HybridState.h"
+#include "StateVector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <Eigen/SVD>
+
+namespace qlay
+{
+	namespace
+	{
+		//Most paths enumerated before giving up
+		constexpr double MAX_PATHS = 4294967296.0;
+
+		//Most amplitudes of the halves of every path held at once, 16 GiB
+		constexpr double MAX_STORED = 1073741824.0;
+
+		//Terms smaller than this fraction of the largest are dropped from a decomposition
+		constexpr double NEGLIGIBLE_TERM = 1e-12;
+
+		//Paths reduced together, bounding the memory of partial results
+		constexpr long long PATH_BLOCK = 256;
+	}
+
+	void HybridState::record(std::vector<int> qubits, const Mat &m)
+	{
+		Operation op = { std::move(qubits), m, {} };
+
+		if (op.qubits.size() == 2)
+		{
+			//Operator Schmidt decomposition: rearranging m so that rows index the first
+			//qubit's matrix elements and columns the second's, each singular vector pair
+			//gives one product term
+			Mat r(4, 4);
+			for (int ra = 0; ra < 2; ra++)
+				for (int ca = 0; ca < 2; ca++)
+					for (int rb = 0; rb < 2; rb++)
+						for (int cb = 0; cb < 2; cb++)
+							r(ra * 2 + ca, rb * 2 + cb) = m((ra << 1) | rb, (ca << 1) | cb);
+
+			Eigen::JacobiSVD<Mat> svd(r, Eigen::ComputeFullU | Eigen::ComputeFullV);
+			const Eigen::VectorXd &sv = svd.singularValues();
+
+			for (int k = 0; k < 4 && sv(k) > NEGLIGIBLE_TERM * sv(0); k++)
+			{
+				Mat a(2, 2), b(2, 2);
+				for (int row = 0; row < 2; row++)
+					for (int col = 0; col < 2; col++)
+					{
+						a(row, col) = sv(k) * svd.matrixU()(row * 2 + col, k);
+						b(row, col) = std::conj(svd.matrixV()(row * 2 + col, k));
+					}
+
+				op.terms.emplace_back(a, b);
+			}
+		}
+
+		ops_.push_back(std::move(op));
+	}
+
+	HybridState::Plan HybridState::plan() const
+	{
+		//Work is the number of paths times the size of the two halves
+		Plan best = { count_, 1 };
+		double best_cost = std::numeric_limits<double>::infinity();
+
+		for (int cut = 0; cut <= count_; cut++)
+		{
+			double log_paths = 0;
+			for (const Operation &op : ops_)
+				if (op.qubits.size() == 2 && (op.qubits[0] < cut) != (op.qubits[1] < cut))
+					log_paths += std::log2(static_cast<double>(op.terms.size()));
+
+			double cost = log_paths + std::log2(std::ldexp(1.0, cut) + std::ldexp(1.0, count_ - cut));
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best = { cut, std::exp2(log_paths) };
+			}
+		}
+
+		if (best.paths > MAX_PATHS)
+			throw std::length_error("Too many gates act across every cut of the qubits to enumerate their paths");
+
+		return best;
+	}
+
+	void HybridState::simulate(const Plan &plan, std::size_t path, Complex *low, Complex *high) const
+	{
+		const Eigen::Index low_size = Eigen::Index(1) << plan.cut;
+		const Eigen::Index high_size = Eigen::Index(1) << (count_ - plan.cut);
+		std::fill(low, low + low_size, Complex(0));
+		std::fill(high, high + high_size, Complex(0));
+		low[0] = 1;
+		high[0] = 1;
+
+		//Applies a single-qubit operator to whichever half holds q
+		auto apply_to = [&](const Mat &m, int q)
+		{
+			if (q < plan.cut)
+				apply_kernel(low, low_size, m, q);
+			else
+				apply_kernel(high, high_size, m, q - plan.cut);
+		};
+
+		//The path index gives the term chosen at each crossing gate, in mixed radix
+		for (const Operation &op : ops_)
+		{
+			if (op.qubits.size() == 1)
+			{
+				apply_to(op.m, op.qubits[0]);
+				continue;
+			}
+
+			int a = op.qubits[0], b = op.qubits[1];
+			if ((a < plan.cut) != (b < plan.cut))
+			{
+				const auto &term = op.terms[path % op.terms.size()];
+				path /= op.terms.size();
+
+				apply_to(term.first, a);
+				apply_to(term.second, b);
+			}
+			else if (a < plan.cut)
+				apply_kernel(low, low_size, op.m, a, b);
+			else
+				apply_kernel(high, high_size, op.m, a - plan.cut, b - plan.cut);
+		}
+	}
+
+	void HybridState::simulate_all(const Plan &plan, Mat &low, Mat &high) const
+	{
+		//The chosen cut minimises this too, so no other would fit
+		const double stored = plan.paths * (std::ldexp(1.0, plan.cut) + std::ldexp(1.0, count_ - plan.cut));
+		if (stored > MAX_STORED)
+			throw std::length_error("Every path across the cut of the qubits would need 2^"
+				+ std::to_string(static_cast<int>(std::round(std::log2(stored)))) + " amplitudes held at once");
+
+		const long long paths = static_cast<long long>(plan.paths);
+		low.resize(Eigen::Index(1) << plan.cut, paths);
+		high.resize(Eigen::Index(1) << (count_ - plan.cut), paths);
+
+		//Each path is simulated in place in its columns
+		#pragma omp parallel for schedule(dynamic)
+		for (long long p = 0; p < paths; p++)
+			simulate(plan, static_cast<std::size_t>(p), low.col(p).data(), high.col(p).data());
+	}
+
+	Complex HybridState::expect(const Plan &plan, const Mat &low, const Mat &high, const std::map<int, Mat> &ops) const
+	{
+		//<psi|O|psi> sums <low_p|O|low_p'> <high_p|O|high_p'> over every pair of paths.
+		//The operator is applied to one block of paths p' at a time, and the Gram
+		//contributions of each pair of blocks reduced in a fixed order, so neither a second
+		//copy of every half nor the full Gram matrices are ever held.
+		const long long paths = low.cols();
+		const long long blocks = (paths + PATH_BLOCK - 1) / PATH_BLOCK;
+		std::vector<Complex> partial(static_cast<std::size_t>(blocks));
+
+		Complex sum = 0;
+		for (long long j = 0; j < blocks; j++)
+		{
+			const long long start = j * PATH_BLOCK, width = std::min(PATH_BLOCK, paths - start);
+
+			//Apply each half of the operator to the block's paths
+			Mat op_low = low.middleCols(start, width), op_high = high.middleCols(start, width);
+			for (const auto &op : ops)
+			{
+				bool is_low = op.first < plan.cut;
+				Mat &halves = is_low ? op_low : op_high;
+				int q = is_low ? op.first : op.first - plan.cut;
+
+				for (Eigen::Index p = 0; p < halves.cols(); p++)
+					apply_kernel(halves.col(p).data(), halves.rows(), op.second, q);
+			}
+
+			#pragma omp parallel for schedule(dynamic) if(blocks > 1)
+			for (long long i = 0; i < blocks; i++)
+			{
+				const long long from = i * PATH_BLOCK, n = std::min(PATH_BLOCK, paths - from);
+				Mat gram_low = low.middleCols(from, n).adjoint() * op_low;
+				Mat gram_high = high.middleCols(from, n).adjoint() * op_high;
+				partial[i] = gram_low.cwiseProduct(gram_high).sum();
+			}
+
+			for (Complex c : partial)
+				sum += c;
+		}
+
+		return sum;
+	}
+
+	Complex HybridState::expect(const std::map<int, Mat> &ops) const
+	{
+		Plan p = plan();
+
+		Mat low, high;
+		simulate_all(p, low, high);
+
+		return expect(p, low, high, ops);
+	}
+
+	void HybridState::add_qubit()
+	{
+		count_++;
+	}
+
+	void HybridState::reset()
+	{
+		ops_.clear();
+	}
+
+	void HybridState::apply(const Mat &m, int q)
+	{
+		record({ q }, m);
+	}
+
+	void HybridState::apply(const Mat &m, int a, int b)
+	{
+		record({ a, b }, m);
+	}
+
+	void HybridState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		Plan pl = plan();
+		Mat low, high;
+		simulate_all(pl, low, high);
+
+		//Unravel the channel: pick one Kraus operator with probability <psi|K^dagger K|psi>
+		double u = rng.uniform();
+
+		std::size_t chosen = 0;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			double pk = expect(pl, low, high, { { q, kraus[k].adjoint() * kraus[k] } }).real();
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = k;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		record({ q }, kraus[chosen] / std::sqrt(p));
+	}
+
+	double HybridState::probability(int q) const
+	{
+		return expect({ { q, (Mat(2, 2) << 0, 0, 0, 1).finished() } }).real();
+	}
+
+	double HybridState::probability(Bitstring outcome) const
+	{
+		Plan p = plan();
+		const long long paths = static_cast<long long>(p.paths);
+
+		const Eigen::Index x_low = static_cast<Eigen::Index>(outcome & ((Bitstring(1) << p.cut) - 1));
+		const Eigen::Index x_high = static_cast<Eigen::Index>(p.cut < 64 ? outcome >> p.cut : 0);
+
+		//A single amplitude needs only one entry of each half, so paths are never stored:
+		//each block of paths is simulated in parallel and its terms summed in a fixed
+		//order, so the result does not depend on the number of threads
+		std::vector<Complex> terms(static_cast<std::size_t>(PATH_BLOCK));
+		Complex amplitude = 0;
+
+		for (long long start = 0; start < paths; start += PATH_BLOCK)
+		{
+			const long long width = std::min(PATH_BLOCK, paths - start);
+
+			#pragma omp parallel
+			{
+				Ket l(Eigen::Index(1) << p.cut), h(Eigen::Index(1) << (count_ - p.cut));
+
+				#pragma omp for schedule(dynamic)
+				for (long long i = 0; i < width; i++)
+				{
+					simulate(p, static_cast<std::size_t>(start + i), l.data(), h.data());
+					terms[i] = l(x_low) * h(x_high);
+				}
+			}
+
+			for (long long i = 0; i < width; i++)
+				amplitude += terms[i];
+		}
+
+		return std::norm(amplitude);
+	}
+
+	std::vector<double> HybridState::marginal(const std::vector<int> &indices) const
+	{
+		static const Mat PROJECT[] = {
+			(Mat(2, 2) << 1, 0, 0, 0).finished(),
+			(Mat(2, 2) << 0, 0, 0, 1).finished()
+		};
+
+		Plan pl = plan();
+		Mat low, high;
+		simulate_all(pl, low, high);
+
+		std::vector<double> prob(Bitstring(1) << indices.size());
+		for (Bitstring o = 0; o < prob.size(); o++)
+		{
+			std::map<int, Mat> ops;
+			for (std::size_t j = 0; j < indices.size(); j++)
+				ops[indices[j]] = PROJECT[(o >> j) & 1];
+
+			prob[o] = std::max(0.0, expect(pl, low, high, ops).real());
+		}
+
+		return prob;
+	}
+
+	void HybridState::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		//Record a projection of each qubit, the first also renormalising
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			Mat projector = Mat::Zero(2, 2);
+			projector((outcome >> j) & 1, (outcome >> j) & 1) = j == 0 ? 1 / std::sqrt(p) : 1;
+			record({ indices[j] }, projector);
+		}
+	}
+
+	double HybridState::expectation(const PauliString &p) const
+	{
+		static const Mat *paulis[] = { nullptr, &PAULI_X, &PAULI_Z, &PAULI_Y };
+
+		std::map<int, Mat> ops;
+		for (int q = 0; q < count_ && q < 64; q++)
+		{
+			const Mat *op = paulis[((p.x_mask() >> q) & 1) | (((p.z_mask() >> q) & 1) << 1)];
+			if (op)
+				ops[q] = *op;
+		}
+
+		return expect(ops).real();
+	}
+
+	void HybridState::print(std::ostream &os, int count) const
+	{
+		Plan pl = plan();
+		Mat low, high;
+		simulate_all(pl, low, high);
+
+		//Sum the product of the halves over every path
+		const Eigen::Index mask = (Eigen::Index(1) << pl.cut) - 1;
+		Ket v(Eigen::Index(1) << count_);
+		for (Eigen::Index i = 0; i < v.size(); i++)
+			v(i) = low.row(i & mask).cwiseProduct(high.row(i >> pl.cut)).sum();
+
+		StateVector(std::move(v), count).print(os, count);
+	}
+
+	BackendReport HybridState::report() const
+	{
+		double memory = 0;
+		for (const Operation &op : ops_)
+			memory += (op.m.size() + 8.0 * op.terms.size()) * sizeof(Complex);
+
+		//Gates are only recorded; each query simulates every path
+		double cost = std::numeric_limits<double>::infinity();
+		try
+		{
+			Plan p = plan();
+			cost = p.paths * (std::ldexp(1.0, p.cut) + std::ldexp(1.0, count_ - p.cut));
+		}
+		catch (const std::length_error &)
+		{
+		}
+
+		return { Backend::Hybrid, memory, cost, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> HybridState::fork() const
+	{
+		return std::make_unique<HybridState>(*this);
+	}
+}
@@ -0,0 +1,84 @@
+/**
+ * @file HybridState.h
+ *
+ * Internal header defining the Schrödinger-Feynman hybrid backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+#include <map>
+
+namespace qlay
+{
+	//Records the gates applied, then simulates the circuit as two half-size state
+	//vectors. Each two-qubit gate acting across the cut is decomposed into a sum
+	//of products of single-qubit operators; every choice of one term per such gate
+	//gives a path whose halves are simulated independently, in parallel, and the
+	//state is the sum over paths of the product of their halves.
+	class HybridState : public State
+	{
+	private:
+		//Operator applied to the given qubits, with the first as the high-order input
+		struct Operation
+		{
+			std::vector<int> qubits;
+			Mat m;
+
+			//For two-qubit operators, terms (A, B) with m the sum of A (x) B
+			std::vector<std::pair<Mat, Mat>> terms;
+		};
+
+		//Division of the qubits below and above a cut, with the number of paths across it
+		struct Plan
+		{
+			int cut;
+			double paths;
+		};
+
+		std::vector<Operation> ops_;
+		int count_ = 0;
+
+		//Records an operation, decomposing it if it acts on two qubits
+		void record(std::vector<int> qubits, const Mat &m);
+
+		//Chooses the cut minimising the total work of simulating every path,
+		//throwing std::length_error if there are too many paths to enumerate
+		Plan plan() const;
+
+		//Simulates the given path, writing its lower and upper halves to the given arrays
+		void simulate(const Plan &plan, std::size_t path, Complex *low, Complex *high) const;
+
+		//Simulates every path, storing the halves as the columns of low and high,
+		//throwing std::length_error if they would not fit in memory
+		void simulate_all(const Plan &plan, Mat &low, Mat &high) const;
+
+		//Returns <psi|O|psi> for O the product of the given single-qubit operators,
+		//given the halves of every path
+		Complex expect(const Plan &plan, const Mat &low, const Mat &high, const std::map<int, Mat> &ops) const;
+		Complex expect(const std::map<int, Mat> &ops) const;
+
+	public:
+		HybridState() = default;
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+	};
+}
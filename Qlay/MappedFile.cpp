@@ -0,0 +1,249 @@
+/**
+ * @file MappedFile.cpp
+ *
+ * Implements files mapped into memory, for Windows and POSIX systems.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "MappedFile.h"
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace qlay
+{
+	MappedFile::~MappedFile()
+	{
+		unmap();
+		close();
+	}
+
+	MappedFile::MappedFile(MappedFile &&other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+	{
+		if (this != &other)
+		{
+			unmap();
+			close();
+
+			std::swap(data_, other.data_);
+			std::swap(size_, other.size_);
+			std::swap(writable_, other.writable_);
+			std::swap(file_, other.file_);
+			#ifdef _WIN32
+			std::swap(mapping_, other.mapping_);
+			#endif
+		}
+
+		return *this;
+	}
+
+	#ifdef _WIN32
+
+	MappedFile MappedFile::temporary(const std::string &directory)
+	{
+		std::filesystem::path dir = directory.empty() ? std::filesystem::temp_directory_path() : std::filesystem::u8path(directory);
+		wchar_t name[MAX_PATH];
+		if (!GetTempFileNameW(dir.wstring().c_str(), L"qly", 0, name))
+			throw std::runtime_error("Could not name a temporary file in " + dir.u8string());
+
+		//Temporary files are kept in the cache where possible, and deleted once closed
+		MappedFile f;
+		HANDLE file = CreateFileW(name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			throw std::runtime_error("Could not create a temporary file in " + dir.u8string());
+
+		f.file_ = file;
+		return f;
+	}
+
+	MappedFile MappedFile::open(const std::string &path)
+	{
+		MappedFile f;
+		HANDLE file = CreateFileW(std::filesystem::u8path(path).wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+			nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			throw std::runtime_error("Could not open " + path);
+
+		f.file_ = file;
+		f.writable_ = false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+			throw std::runtime_error("Could not open " + path);
+
+		f.size_ = static_cast<std::size_t>(size.QuadPart);
+		f.map();
+		return f;
+	}
+
+	void MappedFile::resize(std::size_t size)
+	{
+		unmap();
+
+		LARGE_INTEGER end;
+		end.QuadPart = static_cast<LONGLONG>(size);
+		if (!SetFilePointerEx(file_, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file_))
+			throw std::runtime_error("Could not resize mapped file");
+
+		size_ = size;
+		map();
+	}
+
+	void MappedFile::map()
+	{
+		//Windows cannot map an empty file
+		if (size_ == 0)
+			return;
+
+		mapping_ = CreateFileMappingW(file_, nullptr, writable_ ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping_)
+			throw std::runtime_error("Could not map file");
+
+		data_ = MapViewOfFile(mapping_, writable_ ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+		if (!data_)
+			throw std::runtime_error("Could not map file");
+	}
+
+	void MappedFile::unmap()
+	{
+		if (data_)
+			UnmapViewOfFile(data_);
+		if (mapping_)
+			CloseHandle(mapping_);
+
+		data_ = nullptr;
+		mapping_ = nullptr;
+	}
+
+	void MappedFile::close()
+	{
+		if (file_)
+			CloseHandle(file_);
+
+		file_ = nullptr;
+	}
+
+	void MappedFile::prefetch(std::size_t offset, std::size_t length) const
+	{
+		WIN32_MEMORY_RANGE_ENTRY range = { static_cast<char *>(data_) + offset, length };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+
+	void MappedFile::release(std::size_t offset, std::size_t length) const
+	{
+		//Unlocking pages that are not locked removes them from the working set
+		void *start = static_cast<char *>(data_) + offset;
+		FlushViewOfFile(start, length);
+		VirtualUnlock(start, length);
+	}
+
+	#else
+
+	MappedFile MappedFile::temporary(const std::string &directory)
+	{
+		std::filesystem::path dir = directory.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(directory);
+		std::string name = (dir / "qlay-XXXXXX").string();
+
+		MappedFile f;
+		f.file_ = mkstemp(&name[0]);
+		if (f.file_ < 0)
+			throw std::runtime_error("Could not create a temporary file in " + dir.string());
+
+		//The file is deleted once its descriptor is closed
+		unlink(name.c_str());
+		return f;
+	}
+
+	MappedFile MappedFile::open(const std::string &path)
+	{
+		MappedFile f;
+		f.file_ = ::open(path.c_str(), O_RDONLY);
+		if (f.file_ < 0)
+			throw std::runtime_error("Could not open " + path);
+
+		f.writable_ = false;
+
+		struct stat info;
+		if (fstat(f.file_, &info) != 0)
+			throw std::runtime_error("Could not open " + path);
+
+		f.size_ = static_cast<std::size_t>(info.st_size);
+		f.map();
+		return f;
+	}
+
+	void MappedFile::resize(std::size_t size)
+	{
+		unmap();
+
+		if (ftruncate(file_, static_cast<off_t>(size)) != 0)
+			throw std::runtime_error("Could not resize mapped file");
+
+		size_ = size;
+		map();
+	}
+
+	void MappedFile::map()
+	{
+		if (size_ == 0)
+			return;
+
+		const int protection = writable_ ? PROT_READ | PROT_WRITE : PROT_READ;
+		void *p = mmap(nullptr, size_, protection, MAP_SHARED, file_, 0);
+		if (p == MAP_FAILED)
+			throw std::runtime_error("Could not map file");
+
+		data_ = p;
+	}
+
+	void MappedFile::unmap()
+	{
+		if (data_)
+			munmap(data_, size_);
+
+		data_ = nullptr;
+	}
+
+	void MappedFile::close()
+	{
+		if (file_ >= 0)
+			::close(file_);
+
+		file_ = -1;
+	}
+
+	void MappedFile::prefetch(std::size_t offset, std::size_t length) const
+	{
+		madvise(static_cast<char *>(data_) + offset, length, MADV_WILLNEED);
+	}
+
+	void MappedFile::release(std::size_t offset, std::size_t length) const
+	{
+		//Dirty pages of a shared mapping stay in the page cache once dropped
+		void *start = static_cast<char *>(data_) + offset;
+		msync(start, length, MS_ASYNC);
+		madvise(start, length, MADV_DONTNEED);
+	}
+
+	#endif
+}
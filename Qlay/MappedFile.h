@@ -0,0 +1,74 @@
+/**
+ * @file MappedFile.h
+ *
+ * Internal header defining a file mapped into memory.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace qlay
+{
+	//File mapped into the address space, so that its pages are loaded on demand
+	//and, unless opened read-only, written back by the operating system
+	class MappedFile
+	{
+	private:
+		void *data_ = nullptr;
+		std::size_t size_ = 0;
+		bool writable_ = true;
+
+		#ifdef _WIN32
+		void *file_ = nullptr;
+		void *mapping_ = nullptr;
+		#else
+		int file_ = -1;
+		#endif
+
+		void map();
+		void unmap();
+		void close();
+
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+		MappedFile(MappedFile &&other) noexcept;
+		MappedFile &operator=(MappedFile &&other) noexcept;
+
+		//Creates an empty file in the given directory, or the temporary directory if empty,
+		//deleted once closed. Throws std::runtime_error should it not be created.
+		static MappedFile temporary(const std::string &directory = "");
+
+		//Maps an existing file read-only. Throws std::runtime_error should it not be opened.
+		static MappedFile open(const std::string &path);
+
+		//Changes the size of the file in bytes, remapping it. Any extension is
+		//zero-filled. Throws std::runtime_error should the operating system fail.
+		void resize(std::size_t size);
+
+		//Returns whether a file is held
+		#ifdef _WIN32
+		bool is_open() const { return file_ != nullptr; }
+		#else
+		bool is_open() const { return file_ >= 0; }
+		#endif
+
+		void *data() const { return data_; }
+		std::size_t size() const { return size_; }
+
+		//Hints that the given byte range will soon be accessed, so that it is read in
+		//the background
+		void prefetch(std::size_t offset, std::size_t length) const;
+
+		//Starts writing back the given byte range and drops it from the working set,
+		//without waiting for the write to complete
+		void release(std::size_t offset, std::size_t length) const;
+	};
+}
@@ -0,0 +1,444 @@
+/**
+ * @file MatrixProductState.cpp
+ *
+ * Implements the matrix product state backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "MatrixProductState.h"
+
+#include <Eigen/SVD>
+
+namespace qlay
+{
+	namespace
+	{
+		//Exchanges two neighbouring sites
+		const Mat EXCHANGE ((Mat(4, 4) <<
+			1, 0, 0, 0,
+			0, 0, 1, 0,
+			0, 1, 0, 0,
+			0, 0, 0, 1).finished());
+
+		//Projectors onto |0> and |1>
+		const Mat PROJECT[] = {
+			(Mat(2, 2) << 1, 0, 0, 0).finished(),
+			(Mat(2, 2) << 0, 0, 0, 1).finished()
+		};
+	}
+
+	void MatrixProductState::add_qubit()
+	{
+		//A product state |0> with unit bonds is orthonormal from both sides
+		sites_.push_back({ Mat::Ones(1, 1), Mat::Zero(1, 1) });
+	}
+
+	void MatrixProductState::reset()
+	{
+		for (Site &site : sites_)
+			site = { Mat::Ones(1, 1), Mat::Zero(1, 1) };
+
+		centre_ = 0;
+		discarded_ = 0;
+	}
+
+	void MatrixProductState::set_truncation(const Truncation &truncation)
+	{
+		truncation_ = truncation;
+	}
+
+	void MatrixProductState::move_centre(int site)
+	{
+		//Sweep right, leaving the Q factor of each site behind
+		while (centre_ < site)
+		{
+			Site &a = sites_[centre_];
+			Eigen::Index rows = a[0].rows(), cols = a[0].cols();
+
+			Mat m(2 * rows, cols);
+			m << a[0], a[1];
+
+			Eigen::HouseholderQR<Mat> qr(m);
+			Eigen::Index k = std::min(2 * rows, cols);
+			Mat q = qr.householderQ() * Mat::Identity(2 * rows, k);
+			Mat r = qr.matrixQR().topRows(k).triangularView<Eigen::Upper>();
+
+			a[0] = q.topRows(rows);
+			a[1] = q.bottomRows(rows);
+
+			Site &b = sites_[centre_ + 1];
+			b[0] = r * b[0];
+			b[1] = r * b[1];
+			centre_++;
+		}
+
+		//Sweep left, factoring each site as L Q via the QR decomposition of its adjoint
+		while (centre_ > site)
+		{
+			Site &a = sites_[centre_];
+			Eigen::Index rows = a[0].rows(), cols = a[0].cols();
+
+			Mat m(2 * cols, rows);
+			m << a[0].adjoint(), a[1].adjoint();
+
+			Eigen::HouseholderQR<Mat> qr(m);
+			Eigen::Index k = std::min(2 * cols, rows);
+			Mat q = qr.householderQ() * Mat::Identity(2 * cols, k);
+			Mat l = qr.matrixQR().topRows(k).triangularView<Eigen::Upper>();
+			l.adjointInPlace();
+
+			a[0] = q.topRows(cols).adjoint();
+			a[1] = q.bottomRows(cols).adjoint();
+
+			Site &b = sites_[centre_ - 1];
+			b[0] = b[0] * l;
+			b[1] = b[1] * l;
+			centre_--;
+		}
+	}
+
+	void MatrixProductState::apply_site(const Mat &m, int q)
+	{
+		Site &a = sites_[q];
+		Mat a0 = m(0, 0) * a[0] + m(0, 1) * a[1];
+		a[1] = m(1, 0) * a[0] + m(1, 1) * a[1];
+		a[0] = std::move(a0);
+	}
+
+	void MatrixProductState::apply_adjacent(const Mat &m, int i)
+	{
+		move_centre(i);
+
+		Site &a = sites_[i];
+		Site &b = sites_[i + 1];
+		Eigen::Index left = a[0].rows(), right = b[0].cols();
+
+		//Contract both sites into theta, rows indexed by (s, left) and columns by (t, right)
+		Mat pair[2][2];
+		for (int s = 0; s < 2; s++)
+			for (int t = 0; t < 2; t++)
+				pair[s][t] = a[s] * b[t];
+
+		Mat theta = Mat::Zero(2 * left, 2 * right);
+		for (int s = 0; s < 2; s++)
+			for (int t = 0; t < 2; t++)
+				for (int k = 0; k < 4; k++)
+				{
+					Complex c = m((s << 1) | t, k);
+					if (c != Complex(0))
+						theta.block(s * left, t * right, left, right) += c * pair[k >> 1][k & 1];
+				}
+
+		Eigen::BDCSVD<Mat> svd(theta, Eigen::ComputeThinU | Eigen::ComputeThinV);
+		const Eigen::VectorXd &sv = svd.singularValues();
+
+		//Drop the smallest singular values while within the bond and error limits
+		double total = sv.squaredNorm();
+		double dropped = 0;
+		Eigen::Index keep = sv.size();
+		while (keep > 1)
+		{
+			double next = sv(keep - 1) * sv(keep - 1);
+			if (keep <= truncation_.max_bond && dropped + next > truncation_.max_error * total)
+				break;
+
+			dropped += next;
+			keep--;
+		}
+
+		discarded_ += dropped / total;
+
+		//Left site takes U, right site takes the renormalised S V^dagger, so the centre moves right
+		Mat u = svd.matrixU().leftCols(keep);
+		Mat sv_dag = (sv.head(keep) / std::sqrt(total - dropped)).asDiagonal() * svd.matrixV().leftCols(keep).adjoint();
+
+		for (int s = 0; s < 2; s++)
+		{
+			a[s] = u.middleRows(s * left, left);
+			b[s] = sv_dag.middleCols(s * right, right);
+		}
+
+		centre_ = i + 1;
+	}
+
+	void MatrixProductState::apply(const Mat &m, int q)
+	{
+		//A unitary on one site preserves its orthonormality, so the centre stays put
+		apply_site(m, q);
+	}
+
+	void MatrixProductState::apply(const Mat &m, int a, int b)
+	{
+		int low = std::min(a, b), high = std::max(a, b);
+
+		//Bring the higher qubit alongside the lower one
+		for (int i = high - 1; i > low; i--)
+			apply_adjacent(EXCHANGE, i);
+
+		//With a on the right, the inputs of m must be exchanged
+		if (a < b)
+			apply_adjacent(m, low);
+		else
+			apply_adjacent(EXCHANGE * m * EXCHANGE, low);
+
+		//Return it to its place
+		for (int i = low + 1; i < high; i++)
+			apply_adjacent(EXCHANGE, i);
+	}
+
+	void MatrixProductState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//With the centre at q the norm of the state is that of the site alone
+		move_centre(q);
+		const Site &a = sites_[q];
+		double u = rng.uniform();
+
+		//Unravel the channel: pick one Kraus operator with probability ||K|psi>||^2
+		std::size_t chosen = 0;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			const Mat &m = kraus[k];
+			double pk = (m(0, 0) * a[0] + m(0, 1) * a[1]).squaredNorm()
+				+ (m(1, 0) * a[0] + m(1, 1) * a[1]).squaredNorm();
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = k;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		apply_site(kraus[chosen] / std::sqrt(p), q);
+	}
+
+	Mat MatrixProductState::transfer(const Mat &env, int i, const Mat &op) const
+	{
+		const Site &a = sites_[i];
+		Mat result = Mat::Zero(a[0].cols(), a[0].cols());
+
+		for (int s = 0; s < 2; s++)
+			for (int t = 0; t < 2; t++)
+				if (op(s, t) != Complex(0))
+					result += op(s, t) * a[s].adjoint() * env * a[t];
+
+		return result;
+	}
+
+	Complex MatrixProductState::contract(const std::vector<const Mat *> &ops) const
+	{
+		if (sites_.empty())
+			return 1;
+
+		//Orthonormal sites outside the operators and centre contract to the identity
+		int first = centre_, last = centre_;
+		for (int i = 0; i < static_cast<int>(ops.size()); i++)
+			if (ops[i])
+			{
+				first = std::min(first, i);
+				last = std::max(last, i);
+			}
+
+		static const Mat IDENTITY = Mat::Identity(2, 2);
+
+		Mat env = Mat::Identity(sites_[first][0].rows(), sites_[first][0].rows());
+		for (int i = first; i <= last; i++)
+			env = transfer(env, i, ops[i] ? *ops[i] : IDENTITY);
+
+		return env.trace();
+	}
+
+	double MatrixProductState::probability(int q) const
+	{
+		std::vector<const Mat *> ops(sites_.size(), nullptr);
+		ops[q] = &PROJECT[1];
+
+		return contract(ops).real();
+	}
+
+	double MatrixProductState::probability(Bitstring outcome) const
+	{
+		//The amplitude is the product of the chosen matrices along the chain
+		Mat row = Mat::Ones(1, 1);
+		for (std::size_t i = 0; i < sites_.size(); i++)
+			row = row * sites_[i][i < 64 ? (outcome >> i) & 1 : 0];
+
+		return std::norm(row(0, 0));
+	}
+
+	std::vector<double> MatrixProductState::marginal(const std::vector<int> &indices) const
+	{
+		//Contract along the chain, splitting the environment at each measured site
+		int first = centre_, last = centre_;
+		std::vector<int> position(sites_.size(), -1);
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			position[indices[j]] = static_cast<int>(j);
+			first = std::min(first, indices[j]);
+			last = std::max(last, indices[j]);
+		}
+
+		static const Mat IDENTITY = Mat::Identity(2, 2);
+
+		std::vector<std::pair<Bitstring, Mat>> branches;
+		branches.emplace_back(0, Mat::Identity(sites_[first][0].rows(), sites_[first][0].rows()));
+
+		for (int i = first; i <= last; i++)
+		{
+			if (position[i] < 0)
+			{
+				for (auto &branch : branches)
+					branch.second = transfer(branch.second, i, IDENTITY);
+				continue;
+			}
+
+			std::vector<std::pair<Bitstring, Mat>> next;
+			next.reserve(2 * branches.size());
+			for (const auto &branch : branches)
+				for (Bitstring b = 0; b < 2; b++)
+					next.emplace_back(branch.first | (b << position[i]), transfer(branch.second, i, PROJECT[b]));
+
+			branches = std::move(next);
+		}
+
+		std::vector<double> prob(Bitstring(1) << indices.size(), 0.0);
+		for (const auto &branch : branches)
+			prob[branch.first] = std::max(0.0, branch.second.trace().real());
+
+		return prob;
+	}
+
+	void MatrixProductState::collapse(const std::vector<int> &indices, Bitstring outcome, double)
+	{
+		//Project one site at a time at the centre, renormalising locally so that
+		//truncation errors do not accumulate into the given probability
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			move_centre(indices[j]);
+
+			Site &a = sites_[indices[j]];
+			a[((outcome >> j) & 1) ^ 1].setZero();
+
+			double norm = std::sqrt(a[0].squaredNorm() + a[1].squaredNorm());
+			if (norm > 0)
+			{
+				a[0] /= norm;
+				a[1] /= norm;
+			}
+		}
+	}
+
+	Bitstring MatrixProductState::measure(const std::vector<int> &indices)
+	{
+		//Measuring one qubit after another draws from the joint distribution
+		//without enumerating its 2^k outcomes
+		Bitstring outcome = 0;
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			move_centre(indices[j]);
+
+			const Site &a = sites_[indices[j]];
+			double p1 = a[1].squaredNorm() / (a[0].squaredNorm() + a[1].squaredNorm());
+			Bitstring b = chance(p1) ? 1 : 0;
+
+			collapse({ indices[j] }, b, 0);
+			outcome |= b << j;
+		}
+
+		return outcome;
+	}
+
+	Bitstring MatrixProductState::sample_prefix(int last, const std::vector<int> &indices) const
+	{
+		//With every site right-orthonormal, the conditional probability of each
+		//outcome is the squared norm of the row vector contracted so far
+		Bitstring bits = 0;
+		Mat row = Mat::Ones(1, 1);
+		for (int i = 0; i <= last; i++)
+		{
+			Mat next[2] = { row * sites_[i][0], row * sites_[i][1] };
+			double p0 = next[0].squaredNorm(), p1 = next[1].squaredNorm();
+
+			int b = rng.uniform() * (p0 + p1) < p1 ? 1 : 0;
+			row = next[b] / std::sqrt(b ? p1 : p0);
+			bits |= Bitstring(b) << i;
+		}
+
+		return gather_bits(bits, indices);
+	}
+
+	std::vector<Bitstring> MatrixProductState::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		if (indices.empty())
+			return std::vector<Bitstring>(shots, 0);
+
+		MatrixProductState s = *this;
+		s.move_centre(0);
+
+		int last = *std::max_element(indices.begin(), indices.end());
+
+		std::vector<Bitstring> outcomes(shots);
+		for (unsigned shot = 0; shot < shots; shot++)
+			outcomes[shot] = s.sample_prefix(last, indices);
+
+		return outcomes;
+	}
+
+	double MatrixProductState::expectation(const PauliString &p) const
+	{
+		static const Mat *paulis[] = { nullptr, &PAULI_X, &PAULI_Z, &PAULI_Y };
+
+		Bitstring x = p.x_mask();
+		Bitstring z = p.z_mask();
+
+		std::vector<const Mat *> ops(sites_.size(), nullptr);
+		for (std::size_t i = 0; i < sites_.size() && i < 64; i++)
+			ops[i] = paulis[((x >> i) & 1) | (((z >> i) & 1) << 1)];
+
+		return contract(ops).real();
+	}
+
+	void MatrixProductState::print(std::ostream &os, int count) const
+	{
+		//Print the dimension of each bond, from the highest qubit down
+		os << "Bond dimensions:";
+		for (int i = count - 1; i > 0; i--)
+			os << " " << sites_[i][0].rows();
+		os << std::endl;
+
+		os << "Discarded weight: " << discarded_ << std::endl;
+	}
+
+	int MatrixProductState::largest_bond() const
+	{
+		int bond = 1;
+		for (const Site &site : sites_)
+			bond = std::max(bond, static_cast<int>(site[0].cols()));
+
+		return bond;
+	}
+
+	BackendReport MatrixProductState::report() const
+	{
+		double amplitudes = 0, bond = 1;
+		for (const Site &site : sites_)
+		{
+			amplitudes += 2.0 * site[0].size();
+			bond = std::max(bond, static_cast<double>(site[0].cols()));
+		}
+
+		//A two-site update decomposes a 2 chi x 2 chi matrix
+		return { Backend::MatrixProduct, amplitudes * sizeof(Complex), 8 * bond * bond * bond, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> MatrixProductState::fork() const
+	{
+		return std::make_unique<MatrixProductState>(*this);
+	}
+}
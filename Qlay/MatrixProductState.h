@@ -0,0 +1,79 @@
+/**
+ * @file MatrixProductState.h
+ *
+ * Internal header defining the matrix product state backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+#include <array>
+
+namespace qlay
+{
+	//Matrix product state: qubit i is a site holding one matrix per basis state,
+	//so an amplitude is the product of the chosen matrices along the chain. Memory
+	//grows with the entanglement across each bond rather than with 2^n.
+	class MatrixProductState : public State
+	{
+	private:
+		//The two matrices of a site, of size (left bond) x (right bond)
+		using Site = std::array<Mat, 2>;
+
+		//Sites left of centre_ are left-orthonormal and those right of it right-orthonormal
+		std::vector<Site> sites_;
+		int centre_ = 0;
+
+		Truncation truncation_;
+		double discarded_ = 0;
+
+		//Moves the orthogonality centre to the given site
+		void move_centre(int site);
+
+		//Applies the 4x4 operator m to neighbouring sites i and i + 1, truncating the bond between them
+		void apply_adjacent(const Mat &m, int i);
+
+		//Applies the 2x2 operator m to the matrices of site q
+		void apply_site(const Mat &m, int q);
+
+		//Contracts site i into the environment env, weighting the basis pair (s, t) by op(s, t)
+		Mat transfer(const Mat &env, int i, const Mat &op) const;
+
+		//Returns <psi|O|psi> for O the product of the given per-site 2x2 operators,
+		//where a null entry stands for the identity
+		Complex contract(const std::vector<const Mat *> &ops) const;
+
+		//Draws an outcome for each site up to and including the given one, assuming
+		//the centre is at site 0, and returns the bits at the given indices
+		Bitstring sample_prefix(int last, const std::vector<int> &indices) const;
+
+	public:
+		MatrixProductState() = default;
+
+		//Returns the largest bond dimension between neighbouring qubits
+		int largest_bond() const;
+
+		void add_qubit() override;
+		void reset() override;
+		void set_truncation(const Truncation &truncation) override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+	};
+}
@@ -0,0 +1,130 @@
+/**
+ * @file Noise.cpp
+ *
+ * Implements noise channels.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Core.h"
+
+#include <stdexcept>
+
+namespace qlay
+{
+	//Defines the Kraus operators of each noise channel
+	namespace kraus
+	{
+		//Amplitude damping
+		std::vector<Mat> amplitude_damping(double gamma)
+		{
+			return {
+				(Mat(2, 2) << 1,                   0,
+				              0, std::sqrt(1 - gamma)).finished(),
+				(Mat(2, 2) << 0, std::sqrt(gamma),
+				              0,                0).finished()
+			};
+		}
+	}
+
+	//Phase damping with parameter lambda equals a phase flip with this probability
+	static double dephasing_flip(double lambda)
+	{
+		return (1 - std::sqrt(1 - lambda)) / 2;
+	}
+
+	//Allows for rounding in probabilities combined from several channels
+	static const double PROBABILITY_TOLERANCE = 1e-12;
+
+	void check_pauli_probabilities(double px, double py, double pz)
+	{
+		if (!(px >= 0 && py >= 0 && pz >= 0 && px + py + pz <= 1 + PROBABILITY_TOLERANCE))
+			throw std::invalid_argument("Pauli error probabilities must be nonnegative and sum to at most 1");
+	}
+
+	void State::apply_pauli_channel(double px, double py, double pz, int q)
+	{
+		check_pauli_probabilities(px, py, pz);
+
+		//Pauli errors are state-independent, so no pass is needed to choose one
+		double u = rng.uniform();
+
+		if (u < px)
+			apply(PAULI_X, q);
+		else if (u < px + py)
+			apply(PAULI_Y, q);
+		else if (u < px + py + pz)
+			apply(PAULI_Z, q);
+	}
+
+
+	//Noise channel functor, parametrised with strength
+	class Channel
+	{
+	private:
+		std::function<std::vector<Mat>(double)> kraus_;
+
+	public:
+		Channel(std::function<std::vector<Mat>(double)> kraus) : kraus_(kraus)
+		{
+		}
+
+		void operator()(double p, const Qubit &q) const
+		{
+			if (!(p >= 0 && p <= 1))
+				throw std::invalid_argument("Noise channel strength must be between 0 and 1");
+
+			//Exact on a density matrix, sampled as a trajectory on a state vector
+			q.system().state_->apply_channel(kraus_(p), q.index());
+		}
+	};
+
+
+	//Pauli noise channel functor
+	class PauliChannel
+	{
+	public:
+		void operator()(double px, double py, double pz, const Qubit &q) const
+		{
+			q.system().state_->apply_pauli_channel(px, py, pz, q.index());
+		}
+	};
+
+
+	namespace channels
+	{
+		const Channel amplitude_damp(kraus::amplitude_damping);
+		const PauliChannel pauli;
+	}
+
+	void depolarize(double p, const Qubit &q) { return channels::pauli(p / 3, p / 3, p / 3, q); }
+	void amplitude_damp(double gamma, const Qubit &q) { return channels::amplitude_damp(gamma, q); }
+	void phase_damp(double lambda, const Qubit &q) { return channels::pauli(0, 0, dephasing_flip(lambda), q); }
+	void pauli_noise(double px, double py, double pz, const Qubit &q) { return channels::pauli(px, py, pz, q); }
+
+
+	void QubitSystem::set_noise(const NoiseModel &noise)
+	{
+		for (double p : { noise.depolarizing, noise.amplitude_damping, noise.phase_damping })
+			if (!(p >= 0 && p <= 1))
+				throw std::invalid_argument("Noise model probabilities must be between 0 and 1");
+
+		noise_ = noise;
+		noisy_ = noise.depolarizing > 0 || noise.amplitude_damping > 0 || noise.phase_damping > 0;
+	}
+
+	void QubitSystem::apply_noise(int q)
+	{
+		if (!noisy_)
+			return;
+
+		//Combine the Pauli parts into a single draw
+		double flip = noise_.depolarizing / 3;
+		double pz = flip + dephasing_flip(noise_.phase_damping) * (1 - 4 * flip);
+		if (noise_.depolarizing > 0 || noise_.phase_damping > 0)
+			state_->apply_pauli_channel(flip, flip, pz, q);
+
+		if (noise_.amplitude_damping > 0)
+			state_->apply_channel(kraus::amplitude_damping(noise_.amplitude_damping), q);
+	}
+}
@@ -0,0 +1,73 @@
+/**
+ * @file Observables.cpp
+ *
+ * Implements non-destructive observable queries.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Core.h"
+
+#include <stdexcept>
+
+namespace qlay
+{
+	PauliString::PauliString(const std::string &ops)
+	{
+		if (ops.size() > 64)
+			throw std::length_error("Pauli string may act on at most 64 qubits");
+
+		for (std::size_t i = 0; i < ops.size(); i++)
+		{
+			Bitstring bit = Bitstring(1) << (ops.size() - 1 - i);
+
+			switch (ops[i])
+			{
+			case 'I': break;
+			case 'X': x_ |= bit; break;
+			case 'Z': z_ |= bit; break;
+			case 'Y': x_ |= bit; z_ |= bit; break;
+			default: throw std::invalid_argument("Pauli string may only contain I, X, Y and Z");
+			}
+		}
+	}
+
+	Complex pauli_phase(const PauliString &p)
+	{
+		static const Complex phases[] = { 1, Complex(0, 1), -1, Complex(0, -1) };
+
+		int ny = 0;
+		for (Bitstring y = p.x_mask() & p.z_mask(); y; y &= y - 1)
+			ny++;
+
+		return phases[ny % 4];
+	}
+
+	double QubitSystem::probability(const Qubit &q) const
+	{
+		return state_->probability(q.index());
+	}
+
+	double QubitSystem::probability(Bitstring outcome) const
+	{
+		if (!within_qubits(outcome, count_))
+			throw std::out_of_range("Outcome has bits beyond the qubits of the system");
+
+		return state_->probability(outcome);
+	}
+
+	std::vector<double> QubitSystem::marginal(const std::vector<int> &indices) const
+	{
+		check_register(indices, count_);
+
+		return state_->marginal(indices);
+	}
+
+	double QubitSystem::expectation(const PauliString &p) const
+	{
+		if (!within_qubits(p.x_mask() | p.z_mask(), count_))
+			throw std::out_of_range("Pauli string acts on qubits beyond those of the system");
+
+		return state_->expectation(p);
+	}
+}
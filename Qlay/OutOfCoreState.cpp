@@ -0,0 +1,580 @@
+/**
+ * @file OutOfCoreState.cpp
+ *
+ * Implements the out-of-core state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "OutOfCoreState.h"
+#include "StateVector.h"
+
+#include <algorithm>
+
+namespace qlay
+{
+	namespace
+	{
+		//Chunks hold 2^20 amplitudes, or 16 MiB
+		constexpr int CHUNK_QUBITS = 20;
+
+		//Calls f(base, chunk) for each chunk of the file in order, with base the index
+		//of its first amplitude, reading the next chunk ahead and releasing each after.
+		//A state within a single chunk is simply left to the operating system.
+		template <typename F>
+		void stream(const MappedFile &file, Eigen::Index chunk, F f)
+		{
+			Complex *v = static_cast<Complex *>(file.data());
+			const Eigen::Index chunks = static_cast<Eigen::Index>(file.size() / sizeof(Complex)) / chunk;
+			const std::size_t bytes = chunk * sizeof(Complex);
+
+			if (chunks == 1)
+			{
+				f(Eigen::Index(0), v);
+				return;
+			}
+
+			for (Eigen::Index c = 0; c < chunks; c++)
+			{
+				if (c + 1 < chunks)
+					file.prefetch((c + 1) * bytes, bytes);
+
+				f(c * chunk, v + c * chunk);
+				file.release(c * bytes, bytes);
+			}
+		}
+
+		//Returns the total probability of each chunk, in one pass
+		std::vector<double> chunk_norms(const MappedFile &file, Eigen::Index chunk)
+		{
+			std::vector<double> norms;
+			stream(file, chunk, [&](Eigen::Index, Complex *v)
+			{
+				double part = 0;
+				#pragma omp parallel for reduction(+:part) if(chunk >= PARALLEL_THRESHOLD)
+				for (Eigen::Index k = 0; k < chunk; k++)
+					part += std::norm(v[k]);
+
+				norms.push_back(part);
+			});
+
+			return norms;
+		}
+	}
+
+	void OutOfCoreState::resize_file()
+	{
+		//The file is created only once needed, so empty states cost nothing
+		if (!file_.is_open())
+			file_ = MappedFile::temporary(scratch_directory());
+
+		file_.resize(static_cast<std::size_t>(size()) * sizeof(Complex));
+	}
+
+	int OutOfCoreState::local_bits() const
+	{
+		return std::min(count_, CHUNK_QUBITS);
+	}
+
+	void OutOfCoreState::flush() const
+	{
+		if (pending_.empty())
+			return;
+
+		const Eigen::Index chunk = chunk_size();
+		stream(file_, chunk, [&](Eigen::Index, Complex *v)
+		{
+			for (const Gate &g : pending_)
+			{
+				if (g.b < 0)
+					apply_kernel(v, chunk, g.m, g.a);
+				else
+					apply_kernel(v, chunk, g.m, g.a, g.b);
+			}
+		});
+
+		pending_.clear();
+	}
+
+	void OutOfCoreState::localise(int q, int keep)
+	{
+		const int high = physical_[q];
+		if (high < local_bits())
+			return;
+
+		//Evict the low-order bit unused for longest
+		int low = -1;
+		for (int l = 0; l < local_bits(); l++)
+			if (l != keep && (low < 0 || last_use_[l] < last_use_[low]))
+				low = l;
+
+		flush();
+		exchange(low, high);
+
+		std::swap(logical_[low], logical_[high]);
+		physical_[logical_[low]] = low;
+		physical_[logical_[high]] = high;
+	}
+
+	void OutOfCoreState::exchange(int low, int high)
+	{
+		const Eigen::Index chunk = chunk_size();
+		const Eigen::Index half = chunk / 2;
+		const Eigen::Index chunks = size() / chunk;
+		const Eigen::Index stride = Eigen::Index(1) << (high - local_bits());
+		const Eigen::Index low_mask = Eigen::Index(1) << low;
+		const std::size_t bytes = chunk * sizeof(Complex);
+		Complex *v = data();
+
+		//Amplitudes with the low bit set in each chunk without the high bit swap with
+		//those with the low bit clear in its partner chunk, which has the high bit set
+		for (Eigen::Index c = 0; c < chunks; c++)
+		{
+			if (c & stride)
+				continue;
+
+			Eigen::Index next = (c + 1) & stride ? c + 1 + stride : c + 1;
+			if (next < chunks)
+			{
+				file_.prefetch(next * bytes, bytes);
+				file_.prefetch((next | stride) * bytes, bytes);
+			}
+
+			Complex *v0 = v + c * chunk;
+			Complex *v1 = v + (c | stride) * chunk;
+
+			#pragma omp parallel for if(half >= PARALLEL_THRESHOLD)
+			for (Eigen::Index k = 0; k < half; k++)
+			{
+				Eigen::Index i = insert_zero(k, low);
+				std::swap(v0[i | low_mask], v1[i]);
+			}
+
+			file_.release(c * bytes, bytes);
+			file_.release((c | stride) * bytes, bytes);
+		}
+	}
+
+	Eigen::Index OutOfCoreState::to_physical(Bitstring outcome) const
+	{
+		Eigen::Index i = 0;
+		for (int q = 0; q < count_ && q < 64; q++)
+			if ((outcome >> q) & 1)
+				i |= Eigen::Index(1) << physical_[q];
+
+		return i;
+	}
+
+	std::vector<int> OutOfCoreState::to_physical(const std::vector<int> &indices) const
+	{
+		std::vector<int> bits;
+		for (int q : indices)
+			bits.push_back(physical_[q]);
+
+		return bits;
+	}
+
+	void OutOfCoreState::add_qubit()
+	{
+		flush();
+
+		//The new qubit takes the new highest bit, so |0> (x) |psi> leaves the
+		//existing amplitudes in the lower half and the extension is zero-filled
+		physical_.push_back(count_);
+		logical_.push_back(count_);
+		last_use_.push_back(0);
+		count_++;
+
+		resize_file();
+		if (count_ == 1)
+			data()[0] = 1;
+	}
+
+	void OutOfCoreState::reset()
+	{
+		//Set to |0...0> state, which is unaffected by the mapping of qubits to bits
+		pending_.clear();
+		if (count_ == 0)
+			return;
+
+		stream(file_, chunk_size(), [&](Eigen::Index, Complex *v)
+		{
+			std::fill(v, v + chunk_size(), Complex(0));
+		});
+
+		data()[0] = 1;
+	}
+
+	void OutOfCoreState::apply(const Mat &m, int q)
+	{
+		localise(q, -1);
+
+		pending_.push_back({ m, physical_[q], -1 });
+		last_use_[physical_[q]] = ++clock_;
+	}
+
+	void OutOfCoreState::apply(const Mat &m, int a, int b)
+	{
+		localise(a, physical_[b]);
+		localise(b, physical_[a]);
+
+		pending_.push_back({ m, physical_[a], physical_[b] });
+		last_use_[physical_[a]] = ++clock_;
+		last_use_[physical_[b]] = clock_;
+	}
+
+	void OutOfCoreState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		localise(q, -1);
+		flush();
+
+		//||K|psi>||^2 = tr(K rho K^dagger), so one pass finding the reduced density
+		//matrix rho of the qubit gives the probability of every Kraus operator
+		const int bit = physical_[q];
+		const Eigen::Index mask = Eigen::Index(1) << bit;
+		const Eigen::Index pairs = chunk_size() / 2;
+
+		double r00 = 0, r11 = 0, r01_re = 0, r01_im = 0;
+		stream(file_, chunk_size(), [&](Eigen::Index, Complex *v)
+		{
+			#pragma omp parallel for reduction(+:r00,r11,r01_re,r01_im) if(pairs >= PARALLEL_THRESHOLD)
+			for (Eigen::Index j = 0; j < pairs; j++)
+			{
+				Eigen::Index i0 = insert_zero(j, bit);
+				Complex a0 = v[i0], a1 = v[i0 | mask];
+				Complex c = a0 * std::conj(a1);
+				r00 += std::norm(a0);
+				r11 += std::norm(a1);
+				r01_re += c.real();
+				r01_im += c.imag();
+			}
+		});
+
+		Mat rho(2, 2);
+		rho << r00, Complex(r01_re, r01_im), Complex(r01_re, -r01_im), r11;
+
+		//Unravel the channel: pick one Kraus operator with probability ||K|psi>||^2
+		double u = rng.uniform();
+
+		std::size_t chosen = 0;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			double pk = (kraus[k] * rho * kraus[k].adjoint()).trace().real();
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = k;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		pending_.push_back({ kraus[chosen] / std::sqrt(p), bit, -1 });
+		last_use_[bit] = ++clock_;
+	}
+
+	double OutOfCoreState::probability(int q) const
+	{
+		flush();
+
+		const Eigen::Index mask = Eigen::Index(1) << physical_[q];
+		const Eigen::Index chunk = chunk_size();
+
+		double p = 0;
+		stream(file_, chunk, [&](Eigen::Index base, Complex *v)
+		{
+			double part = 0;
+			#pragma omp parallel for reduction(+:part) if(chunk >= PARALLEL_THRESHOLD)
+			for (Eigen::Index k = 0; k < chunk; k++)
+				if ((base + k) & mask)
+					part += std::norm(v[k]);
+
+			p += part;
+		});
+
+		return p;
+	}
+
+	double OutOfCoreState::probability(Bitstring outcome) const
+	{
+		flush();
+		return std::norm(data()[to_physical(outcome)]);
+	}
+
+	std::vector<double> OutOfCoreState::marginal(const std::vector<int> &indices) const
+	{
+		flush();
+
+		const std::vector<int> bits = to_physical(indices);
+		const int local = local_bits();
+
+		//Only qubits within a chunk are marginalised there, each outcome of them placed at
+		//its bits of the register, so the work per chunk never exceeds its size
+		std::vector<int> inner, places;
+		for (std::size_t j = 0; j < bits.size(); j++)
+			if (bits[j] < local)
+			{
+				inner.push_back(bits[j]);
+				places.push_back(static_cast<int>(j));
+			}
+
+		std::vector<Bitstring> spread(std::size_t(1) << inner.size());
+		for (std::size_t m = 0; m < spread.size(); m++)
+			spread[m] = static_cast<Bitstring>(scatter_bits(m, places));
+
+		//Bits within a chunk and bits selecting it are disjoint, so their outcomes combine by OR
+		std::vector<double> p(std::size_t(1) << indices.size(), 0.0);
+		stream(file_, chunk_size(), [&](Eigen::Index base, Complex *v)
+		{
+			Bitstring high = gather_bits(base, bits);
+			std::vector<double> part = marginalise(chunk_size(), inner, [v](Eigen::Index k) { return std::norm(v[k]); });
+
+			for (std::size_t m = 0; m < part.size(); m++)
+				if (part[m] > 0)
+					p[high | spread[m]] += part[m];
+		});
+
+		return p;
+	}
+
+	void OutOfCoreState::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		flush();
+
+		const std::vector<int> bits = to_physical(indices);
+
+		//Zero contradictory amplitudes and renormalise the rest in one pass
+		const double scale = 1.0 / std::sqrt(p);
+		const Eigen::Index chunk = chunk_size();
+
+		stream(file_, chunk, [&](Eigen::Index base, Complex *v)
+		{
+			#pragma omp parallel for if(chunk >= PARALLEL_THRESHOLD)
+			for (Eigen::Index k = 0; k < chunk; k++)
+				v[k] = gather_bits(base + k, bits) == outcome ? v[k] * scale : Complex(0);
+		});
+	}
+
+	Bitstring OutOfCoreState::measure(const std::vector<int> &indices)
+	{
+		check_register(indices, count_);
+		flush();
+
+		const std::vector<int> bits = to_physical(indices);
+		const Eigen::Index chunk = chunk_size();
+		Complex *v = data();
+
+		//Draw one basis state from the cumulative distribution, rather than building all
+		//2^k joint outcomes: a pass of chunk totals finds the chunk holding it, which
+		//alone is scanned. Fall back on the last nonzero amplitude should rounding leave
+		//u unmatched.
+		const std::vector<double> norms = chunk_norms(file_, chunk);
+		double u = rng.uniform(), acc = 0;
+
+		std::size_t c = 0;
+		while (c + 1 < norms.size() && (acc + norms[c] <= u || norms[c] == 0))
+			acc += norms[c++];
+		while (c > 0 && norms[c] == 0)
+			c--;
+
+		Eigen::Index chosen = c * chunk;
+		for (Eigen::Index k = c * chunk; k < (Eigen::Index(c) + 1) * chunk; k++)
+		{
+			const double a = std::norm(v[k]);
+			if (a == 0)
+				continue;
+
+			chosen = k;
+			acc += a;
+			if (u < acc)
+				break;
+		}
+
+		const Bitstring result = gather_bits(chosen, bits);
+
+		//Zero contradictory amplitudes in one pass, finding the probability of the outcome
+		//as it goes; the renormalisation waits to be applied with the next gates
+		double p = 0;
+		stream(file_, chunk, [&](Eigen::Index base, Complex *w)
+		{
+			double part = 0;
+			#pragma omp parallel for reduction(+:part) if(chunk >= PARALLEL_THRESHOLD)
+			for (Eigen::Index k = 0; k < chunk; k++)
+			{
+				if (gather_bits(base + k, bits) == result)
+					part += std::norm(w[k]);
+				else
+					w[k] = 0;
+			}
+
+			p += part;
+		});
+
+		pending_.push_back({ Mat::Identity(2, 2) / std::sqrt(p), 0, -1 });
+		return result;
+	}
+
+	std::vector<Bitstring> OutOfCoreState::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		check_register(indices, count_);
+		flush();
+
+		const std::vector<int> bits = to_physical(indices);
+		const Eigen::Index chunk = chunk_size();
+		const Complex *v = data();
+
+		std::vector<double> u(shots);
+		rng.fill_uniform(u.data(), u.size());
+
+		//Visit the draws in increasing order, so that one pass of the cumulative
+		//distribution serves them all; chunks holding none are skipped by their totals
+		std::vector<unsigned> order(shots);
+		for (unsigned i = 0; i < shots; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return u[a] < u[b]; });
+
+		const std::vector<double> norms = chunk_norms(file_, chunk);
+		std::vector<Bitstring> results(shots);
+		Eigen::Index last = 0; //Last nonzero amplitude, for draws rounding leaves unmatched
+		double acc = 0;
+		unsigned next = 0;
+
+		for (std::size_t c = 0; c < norms.size() && next < shots; c++)
+		{
+			if (norms[c] == 0)
+				continue;
+
+			if (acc + norms[c] <= u[order[next]])
+			{
+				acc += norms[c];
+				for (Eigen::Index k = (Eigen::Index(c) + 1) * chunk; k-- > Eigen::Index(c) * chunk;)
+					if (v[k] != Complex(0))
+					{
+						last = k;
+						break;
+					}
+				continue;
+			}
+
+			for (Eigen::Index k = c * chunk; k < (Eigen::Index(c) + 1) * chunk && next < shots; k++)
+			{
+				const double a = std::norm(v[k]);
+				if (a == 0)
+					continue;
+
+				last = k;
+				acc += a;
+				for (; next < shots && u[order[next]] < acc; next++)
+					results[order[next]] = gather_bits(k, bits);
+			}
+		}
+
+		for (; next < shots; next++)
+			results[order[next]] = gather_bits(last, bits);
+
+		return results;
+	}
+
+	double OutOfCoreState::expectation(const PauliString &p) const
+	{
+		flush();
+
+		//The phase only depends on the number of Y factors, so is unchanged by the mapping
+		const Eigen::Index x = to_physical(p.x_mask());
+		const Eigen::Index z = to_physical(p.z_mask());
+		const Eigen::Index chunk = chunk_size();
+		const Complex *all = data();
+
+		//P|j> = i^(#Y) (-1)^(popcount(j & z)) |j ^ x>
+		double re = 0, im = 0;
+		stream(file_, chunk, [&](Eigen::Index base, Complex *v)
+		{
+			double part_re = 0, part_im = 0;
+			#pragma omp parallel for reduction(+:part_re,part_im) if(chunk >= PARALLEL_THRESHOLD)
+			for (Eigen::Index k = 0; k < chunk; k++)
+			{
+				Eigen::Index j = base + k;
+				Complex term = std::conj(all[j ^ x]) * v[k];
+				if (parity(static_cast<Bitstring>(j & z)))
+					term = -term;
+
+				part_re += term.real();
+				part_im += term.imag();
+			}
+
+			re += part_re;
+			im += part_im;
+		});
+
+		//The result is real for a Hermitian P
+		return (pauli_phase(p) * Complex(re, im)).real();
+	}
+
+	void OutOfCoreState::print(std::ostream &os, int count) const
+	{
+		flush();
+
+		//Gather the amplitudes in order of the qubits
+		Ket v(size());
+		for (Eigen::Index i = 0; i < v.size(); i++)
+			v(i) = data()[to_physical(static_cast<Bitstring>(i))];
+
+		StateVector(std::move(v), count).print(os, count);
+	}
+
+	BackendReport OutOfCoreState::report() const
+	{
+		double size = static_cast<double>(this->size());
+		return { Backend::OutOfCore, size * sizeof(Complex), size, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> OutOfCoreState::fork() const
+	{
+		//Mapped files cannot portably be shared copy-on-write, so the fork streams a copy
+		flush();
+
+		auto f = std::make_unique<OutOfCoreState>();
+		f->load(data(), count_, physical_);
+		f->last_use_ = last_use_;
+		f->clock_ = clock_;
+
+		return f;
+	}
+
+	void OutOfCoreState::save(std::ostream &os) const
+	{
+		flush();
+
+		//Written in the order of the file, the bits being given by layout()
+		stream(file_, chunk_size(), [&](Eigen::Index, Complex *v)
+		{
+			os.write(reinterpret_cast<const char *>(v), chunk_size() * sizeof(Complex));
+		});
+	}
+
+	void OutOfCoreState::load(const Complex *v, int count, const std::vector<int> &layout)
+	{
+		//Adopt the saved mapping of qubits to bits, so the amplitudes are copied in order
+		pending_.clear();
+		count_ = count;
+		physical_ = layout;
+		logical_.assign(count, 0);
+		for (int q = 0; q < count; q++)
+			logical_[physical_[q]] = q;
+		last_use_.assign(count, 0);
+
+		if (count == 0 && !file_.is_open())
+			return;
+
+		resize_file();
+		stream(file_, chunk_size(), [&](Eigen::Index base, Complex *chunk)
+		{
+			std::copy(v + base, v + base + chunk_size(), chunk);
+		});
+	}
+}
@@ -0,0 +1,92 @@
+/**
+ * @file OutOfCoreState.h
+ *
+ * Internal header defining the out-of-core state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+#include "MappedFile.h"
+
+namespace qlay
+{
+	//Dense state vector held in a memory-mapped temporary file, so it may exceed
+	//physical memory. The amplitudes are processed in fixed-size chunks, reading
+	//the next chunk ahead and writing each back behind. Gates are queued
+	//and applied together in a single pass over the chunks, which is possible
+	//while they act only on the low-order bits within a chunk: a gate on any other
+	//qubit first exchanges it with the least recently used low-order bit, so the
+	//mapping from qubits to bits of the file changes as the circuit runs.
+	class OutOfCoreState : public State
+	{
+	private:
+		//Queued operator on physical bits a (high-order input) and b, or b < 0 for one qubit
+		struct Gate
+		{
+			Mat m;
+			int a;
+			int b;
+		};
+
+		mutable MappedFile file_;
+		mutable std::vector<Gate> pending_;
+
+		std::vector<int> physical_;       //Physical bit holding each qubit
+		std::vector<int> logical_;        //Qubit held by each physical bit
+		std::vector<std::size_t> last_use_; //Time each low-order bit was last used by a gate
+		std::size_t clock_ = 0;
+		int count_ = 0;
+
+		Complex *data() const { return static_cast<Complex *>(file_.data()); }
+		Eigen::Index size() const { return count_ ? Eigen::Index(1) << count_ : 0; }
+
+		//Number of low-order bits within each chunk
+		int local_bits() const;
+		Eigen::Index chunk_size() const { return Eigen::Index(1) << local_bits(); }
+
+		//Resizes the file to hold size() amplitudes, creating it should there be none
+		void resize_file();
+
+		//Applies every queued gate in one pass over the chunks
+		void flush() const;
+
+		//Ensures qubit q is held by a low-order bit, without moving the physical bit keep
+		void localise(int q, int keep);
+
+		//Exchanges physical bit low, within a chunk, with physical bit high, across chunks
+		void exchange(int low, int high);
+
+		//Maps a basis state of the qubits to its index in the file
+		Eigen::Index to_physical(Bitstring outcome) const;
+
+		//Returns the physical bits holding the given qubits
+		std::vector<int> to_physical(const std::vector<int> &indices) const;
+
+	public:
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+
+		std::vector<int> layout() const override { return physical_; }
+		void save(std::ostream &os) const override;
+		void load(const Complex *v, int count, const std::vector<int> &layout) override;
+	};
+}
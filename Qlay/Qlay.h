@@ -16,12 +16,20 @@
 #endif
 
 #include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+#include <type_traits>
+#include <utility>
 
 namespace qlay
 {
 	//Basis vectors (|0> and |1>) yield binary result
 	using Basis = bool;
 
+	//Joint measurement outcome of several qubits, with bit i holding the ith result
+	using Bitstring = unsigned long long;
+
 	//Pi constant
 	constexpr double PI = 3.14159265358979323846;
 
@@ -29,10 +37,90 @@ namespace qlay
 	const double INV_ROOT_2 = 1.0 / sqrt(2.0);
 
 
+	//Tensor product of single-qubit Pauli operators (I, X, Y or Z), one per qubit
+	class QLAY_API PauliString
+	{
+	private:
+		Bitstring x_ = 0;
+		Bitstring z_ = 0;
+
+	public:
+		//Parses a string such as "XIZ", with the last character acting on qubit 0
+		PauliString(const std::string &ops);
+
+		//Constructs from masks of the qubits with an X part and with a Z part (both set for Y)
+		PauliString(Bitstring x, Bitstring z) : x_(x), z_(z) {}
+
+		//Bits set where the operator flips the qubit (X or Y)
+		Bitstring x_mask() const { return x_; }
+
+		//Bits set where the operator applies a phase (Z or Y)
+		Bitstring z_mask() const { return z_; }
+	};
+
+
 	//State vector (forward declaration used internally)
 	class State;
 
+	//Recorded circuit (forward declaration used internally)
+	class Program;
+
+	class Qubit;
+	class Circuit;
+
+	//Simulation backends which may hold a QubitSystem's state
+	enum class Backend
+	{
+		StateVector,   //Pure state as 2^n complex amplitudes
+		DensityMatrix, //Mixed state as a 2^n x 2^n matrix, supporting noise channels exactly
+		Stabilizer,    //Stabilizer tableau, polynomial in n but limited to Clifford gates and Pauli noise
+		MatrixProduct, //Matrix product state, efficient for weakly entangled chains of qubits
+		Sparse,        //Hash table of nonzero amplitudes, stored densely once most are nonzero
+		Factored,      //Separate state vectors per group of entangled qubits, merged as gates entangle them
+		DecisionDiagram, //Decision diagram sharing identical subtrees, compact for structured states
+		TensorNetwork, //Records gates, contracting a tensor network per query, for local queries on wide circuits
+		Hybrid,        //Schrödinger-Feynman hybrid, summing over paths through gates across a cut of the qubits
+		OutOfCore,     //State vector in a memory-mapped file, for states larger than physical memory
+		Compressed,    //State vector in independently compressed blocks, for states with many zero or repeated amplitudes
+		Automatic      //Chooses and switches between backends by analysing the gates applied
+	};
+
+	//Describes the backend currently simulating a QubitSystem, for logging
+	struct BackendReport
+	{
+		Backend backend;    //Backend in use
+		double memory;      //Estimated memory held, in bytes
+		double gate_cost;   //Estimated work per gate, in amplitude or word updates
+		std::string reason; //Why this backend is in use
+	};
+
+	//Noise applied automatically to every qubit a gate acts upon, just after the gate
+	struct NoiseModel
+	{
+		double depolarizing = 0;      //Probability of a uniformly random X, Y or Z error
+		double amplitude_damping = 0; //Probability of |1> decaying to |0>
+		double phase_damping = 0;     //Probability of losing phase coherence
+	};
+
+	//Limits on the approximation made by truncating backends after each two-qubit gate
+	struct Truncation
+	{
+		int max_bond = 256;       //Largest bond dimension kept between neighbouring qubits
+		double max_error = 1e-12; //Largest fraction of the norm discarded per truncation
+		double compression_error = 0; //Largest change to each amplitude component per lossy compression, 0 for lossless
+	};
+
+	//Gate counts of a circuit before and after Circuit::optimise(), excluding measurements
+	struct OptimisationReport
+	{
+		int before = 0;
+		int after = 0;
+		int cancelled = 0;  //Gates removed as inverse pairs or identities
+		int merged = 0;     //Rotations merged into an earlier rotation about the same axis
+	};
+
 	template class QLAY_API std::shared_ptr<State>;
+	template class QLAY_API std::shared_ptr<Program>;
 
 	//Represents a system of potentially entangled qubits
 	class QLAY_API QubitSystem
@@ -41,26 +129,104 @@ namespace qlay
 		friend class Gate;
 		friend class AngleGate;
 		friend class TwoGate;
+		friend class Channel;
+		friend class PauliChannel;
+		friend class Circuit;
 		friend QLAY_API Basis M(const Qubit &q);
+		friend QLAY_API Bitstring M(QubitSystem &qs, const std::vector<int> &indices);
 
 	private:
 		std::shared_ptr<State> state_;
+		Backend backend_;
+		NoiseModel noise_;
+		Truncation truncation_;
+		bool noisy_ = false;
 		int count_ = 0;
 
+		//Applies the noise model to the qubit at the given index
+		void apply_noise(int q);
+
+		//Adopts the given state, simulated by the given backend
+		QubitSystem(std::shared_ptr<State> state, Backend backend);
+
 	public:
-		//Default constructor prepares empty system
+		//Default constructor prepares empty state vector system
 		QubitSystem();
 
+		//Prepares an empty system simulated by the given backend
+		QubitSystem(Backend backend);
+
+		//Returns the backend this system was constructed with
+		Backend backend() const { return backend_; }
+
+		//Describes the backend currently simulating this system and its estimated cost
+		BackendReport report() const;
+
+		//Sets the noise applied after every subsequent gate
+		void set_noise(const NoiseModel &noise);
+
+		//Returns the noise applied after every gate
+		const NoiseModel &noise() const { return noise_; }
+
+		//Sets the truncation applied by approximate backends, ignored by exact ones
+		void set_truncation(const Truncation &truncation);
+
+		//Returns the truncation applied by approximate backends
+		const Truncation &truncation() const { return truncation_; }
+
 		//Returns the number of qubits in the system
 		int count() const { return count_; }
 
 		//Resets the system such that all qubits are in the |0> state
 		void reset();
 
+		//Samples measurement outcomes of all qubits without collapsing the system
+		std::vector<Bitstring> sample(unsigned shots) const;
+
+		//Samples measurement outcomes of the qubits at the given indices without collapsing the system.
+		//Throws as M() does should the indices not form a valid register.
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const;
+
+		//Returns the probability that measuring the given qubit would yield |1>, without collapsing the system
+		double probability(const Qubit &q) const;
+
+		//Returns the probability of measuring the given outcome of all qubits, without collapsing the system.
+		//Throws std::out_of_range should the outcome set bits beyond the system's qubits.
+		double probability(Bitstring outcome) const;
+
+		//Returns the joint distribution over the qubits at the given indices, without collapsing the system.
+		//Throws as M() does should the indices not form a valid register.
+		std::vector<double> marginal(const std::vector<int> &indices) const;
+
+		//Returns the expectation value <psi|P|psi> of the given Pauli string without collapsing the system.
+		//Throws std::out_of_range should the string act on qubits beyond the system's.
+		double expectation(const PauliString &p) const;
+
+		//Saves the state of the system and this thread's random number generator to a binary file.
+		//Throws std::runtime_error should the file not be written, std::domain_error should
+		//the backend not hold amplitudes, or std::length_error beyond 59 qubits.
+		void save(const std::string &path) const;
+
+		//Replaces the state of the system and this thread's random number generator by those saved
+		//in the given file, loaded into this system's backend; its qubits are then referred to by
+		//index. Throws std::runtime_error should the file not be a valid checkpoint, or
+		//std::domain_error should the backend not load amplitudes.
+		void load(const std::string &path);
+
+		//Returns a new system in the same state, with the same noise and truncation, sharing
+		//storage copy-on-write where the backend allows so that forking costs little until
+		//either system is modified. Qubits of the fork are referred to by index.
+		QubitSystem fork() const;
+
 		//QubitSystems cannot be classically copied
 		QubitSystem(const QubitSystem&) = delete;
 		QubitSystem &operator=(const QubitSystem&) = delete;
 
+		//Moving leaves the source an empty system with the same backend; qubits constructed
+		//on the source still refer to it
+		QubitSystem(QubitSystem &&other);
+		QubitSystem &operator=(QubitSystem &&other);
+
 		QLAY_API friend std::ostream& operator<<(std::ostream& os, const QubitSystem &system);
 	};
 
@@ -89,6 +255,57 @@ namespace qlay
 		Qubit &operator=(const Qubit&) = delete;
 	};
 
+	//Sequence of gates and measurements recorded on qubit indices, compiled once into an
+	//execution plan and then run on any number of QubitSystems
+	class QLAY_API Circuit
+	{
+		friend class Gate;
+		friend class AngleGate;
+		friend class TwoGate;
+		friend QLAY_API void M(Circuit &c, int q);
+
+	private:
+		std::shared_ptr<Program> program_;
+
+	public:
+		//Prepares an empty circuit
+		Circuit();
+
+		Circuit(const Circuit &other);
+		Circuit &operator=(const Circuit &other);
+
+		//Returns the number of qubits acted on, one more than the highest index recorded
+		int count() const;
+
+		//Returns the number of gates and measurements recorded
+		int size() const;
+
+		//Returns the number of measurements recorded, each giving one bit of the result of run()
+		int measurements() const;
+
+		//Returns the number of calls on the backend each run makes, once compiled
+		int steps() const;
+
+		//Removes inverse pairs of gates (such as H H or CNOT CNOT) and merges rotations about the
+		//same axis, across any gates in between they commute with, and returns the gate counts
+		//before and after. The recording is changed, so the circuit must be compiled afterwards.
+		OptimisationReport optimise();
+
+		//Lowers the recorded operations into an execution plan, reordering commuting gates so
+		//as to fuse as many as possible. Called once after recording, before running.
+		void compile();
+
+		//Runs the compiled circuit on the given system, first adding qubits until it has count()
+		//of them, and returns the outcome of the ith measurement in bit i. Noisy systems run the
+		//gates as recorded, so noise follows every gate. Throws std::logic_error should the
+		//circuit have been recorded onto since it was last compiled.
+		Bitstring run(QubitSystem &qs) const;
+
+		//Runs the compiled circuit once per shot in parallel, each shot on a fresh system simulated
+		//by the given backend, returning each shot's result in order
+		std::vector<Bitstring> run(unsigned shots, Backend backend = Backend::StateVector) const;
+	};
+
 
 	//Initialises the system with a seed based on current time
 	QLAY_API void init();
@@ -102,6 +319,33 @@ namespace qlay
 	//Converts the given angle from degrees to radians
 	QLAY_API double deg_to_rad(double angle);
 
+	//Sets the directory in which OutOfCore systems create their files, or, if empty, falls
+	//back on the QLAY_SCRATCH environment variable and then the temporary directory
+	QLAY_API void set_scratch_directory(const std::string &path);
+
+
+	//Calls the shot function n times in parallel, each shot having its own fresh QubitSystem
+	//simulated by the given backend and its own RNG stream (reproducible for a given seed);
+	//the shot's number is passed alongside. Should any shot throw, shots not yet started are
+	//skipped and the exception rethrown.
+	QLAY_API void for_each_shot(unsigned n, const std::function<void(QubitSystem &qs, unsigned shot)> &fn,
+		Backend backend = Backend::StateVector);
+
+	//Runs the shot function n times in parallel, returning each shot's result in order
+	template <typename Function>
+	auto run_shots(unsigned n, Function fn, Backend backend = Backend::StateVector)
+	{
+		using Result = decltype(fn(std::declval<QubitSystem&>()));
+
+		//Avoid std::vector<bool>, whose elements cannot be written concurrently
+		using Stored = std::conditional_t<std::is_same<Result, bool>::value, unsigned char, Result>;
+
+		std::vector<Stored> results(n);
+		for_each_shot(n, [&](QubitSystem &qs, unsigned shot) { results[shot] = fn(qs); }, backend);
+
+		return std::vector<Result>(results.begin(), results.end());
+	}
+
 
 	//Measures the given qubit in the Z (computational) basis
 	QLAY_API Basis M(const Qubit &q);
@@ -109,6 +353,14 @@ namespace qlay
 	//Measures the given qubit in the X (sign) basis
 	QLAY_API Basis Mx(const Qubit &q);
 
+	//Measures every qubit in the system in the Z basis, returning the joint outcome
+	QLAY_API Bitstring M(QubitSystem &qs);
+
+	//Measures the qubits at the given indices in the Z basis, returning the joint outcome.
+	//Joint outcomes hold at most 63 qubits; wider registers throw std::length_error, and
+	//indices beyond the system or repeated throw std::out_of_range or std::invalid_argument.
+	QLAY_API Bitstring M(QubitSystem &qs, const std::vector<int> &indices);
+
 
 	//Pauli X gate (NOT)
 	QLAY_API void X(const Qubit &q);
@@ -147,4 +399,40 @@ namespace qlay
 
 	//Controlled NOT gate
 	QLAY_API void CNOT(const Qubit &control, const Qubit &target);
+
+
+	//Depolarising noise: with probability p, applies one of X, Y or Z uniformly
+	QLAY_API void depolarize(double p, const Qubit &q);
+
+	//Amplitude damping noise: decays |1> to |0> with probability gamma
+	QLAY_API void amplitude_damp(double gamma, const Qubit &q);
+
+	//Phase damping noise: loses phase coherence with probability lambda
+	QLAY_API void phase_damp(double lambda, const Qubit &q);
+
+	//Pauli noise: applies X, Y or Z with the given respective probabilities
+	QLAY_API void pauli_noise(double px, double py, double pz, const Qubit &q);
+
+
+	//Records the gates and measurements above onto a circuit, acting on qubits by index
+	QLAY_API void X(Circuit &c, int q);
+	QLAY_API void Y(Circuit &c, int q);
+	QLAY_API void Z(Circuit &c, int q);
+	QLAY_API void H(Circuit &c, int q);
+	QLAY_API void SRNOT(Circuit &c, int q);
+
+	QLAY_API void Rx(double angle, Circuit &c, int q);
+	QLAY_API void Ry(double angle, Circuit &c, int q);
+	QLAY_API void Rz(double angle, Circuit &c, int q);
+	QLAY_API void Rp(double angle, Circuit &c, int q);
+
+	QLAY_API void SWAP(Circuit &c, int a, int b);
+	QLAY_API void SRSWAP(Circuit &c, int a, int b);
+	QLAY_API void CNOT(Circuit &c, int control, int target);
+
+	//Records a Z basis measurement, its outcome taking the next bit of the result of Circuit::run()
+	QLAY_API void M(Circuit &c, int q);
+
+	//Records an X basis measurement, its outcome taking the next bit of the result of Circuit::run()
+	QLAY_API void Mx(Circuit &c, int q);
 }
@@ -6,71 +6,113 @@
  * @author Sam Griffiths
  */
 
-#include "Core.h"
+#include "StateVector.h"
+#include "DensityMatrix.h"
+#include "Stabilizer.h"
+#include "MatrixProductState.h"
+#include "SparseState.h"
+#include "FactoredState.h"
+#include "DecisionDiagram.h"
+#include "TensorNetwork.h"
+#include "HybridState.h"
+#include "OutOfCoreState.h"
+#include "CompressedState.h"
+#include "Automatic.h"
 
 namespace qlay
 {
-	QubitSystem::QubitSystem() : state_(std::make_shared<State>())
+	std::shared_ptr<State> make_state(Backend backend)
 	{
+		switch (backend)
+		{
+		case Backend::DensityMatrix: return std::make_shared<DensityMatrix>();
+		case Backend::Stabilizer:    return std::make_shared<Stabilizer>();
+		case Backend::MatrixProduct: return std::make_shared<MatrixProductState>();
+		case Backend::Sparse:        return std::make_shared<SparseState>();
+		case Backend::Factored:      return std::make_shared<FactoredState>();
+		case Backend::DecisionDiagram: return std::make_shared<DecisionDiagram>();
+		case Backend::TensorNetwork: return std::make_shared<TensorNetwork>();
+		case Backend::Hybrid:        return std::make_shared<HybridState>();
+		case Backend::OutOfCore:     return std::make_shared<OutOfCoreState>();
+		case Backend::Compressed:    return std::make_shared<CompressedState>();
+		case Backend::Automatic:     return std::make_shared<AutomaticState>();
+		default:                     return std::make_shared<StateVector>();
+		}
 	}
 
-	void QubitSystem::reset()
+	QubitSystem::QubitSystem() : QubitSystem(Backend::StateVector)
 	{
-		Ket &k = state_->get();
+	}
 
-		//Set to |0...0> state
-		k(0) = 1;
-		for (Eigen::Index i = 1; i < k.size(); i++)
-			k(i) = 0;
+	QubitSystem::QubitSystem(Backend backend) : QubitSystem(make_state(backend), backend)
+	{
 	}
 
-	std::ostream& operator<<(std::ostream& os, const QubitSystem &system)
+	QubitSystem::QubitSystem(std::shared_ptr<State> state, Backend backend) : state_(std::move(state)), backend_(backend)
+	{
+	}
+
+	QubitSystem::QubitSystem(QubitSystem &&other) : QubitSystem(other.backend_)
 	{
-		Ket &k = system.state_->get();
+		*this = std::move(other);
+	}
 
-		//Print each coefficient
-		for (Eigen::Index i = 0; i < k.size(); i++)
+	QubitSystem &QubitSystem::operator=(QubitSystem &&other)
+	{
+		if (this != &other)
 		{
-			Complex z = k(i);
-
-			//Format basis vector as binary number
-			os << "|";
-			for (int j = system.count(); j > 0; j--)
-				os << ((i >> (j-1)) & 1);
-			os << "> ";
-
-			//Print coefficient in the form a+bi
-			if (z.real() == 0 && z.imag() == 0)
-				os << 0 << std::endl;
-			else
-			{
-				if (z.real() != 0)
-					os << z.real();
-
-				if (z.imag() != 0)
-				{
-					os << (z.imag() > 0 ? "+" : "-");
-					if (std::abs(z.imag()) != 1)
-						os << std::abs(z.imag());
-					os << "i";
-				}
-
-				os << std::endl;
-			}
+			//The source is left with a fresh empty state, which is cheap to make for every
+			//backend, so that it remains usable
+			std::shared_ptr<State> empty = make_state(other.backend_);
+			empty->set_truncation(other.truncation_);
+
+			state_ = std::exchange(other.state_, std::move(empty));
+			backend_ = other.backend_;
+			noise_ = other.noise_;
+			truncation_ = other.truncation_;
+			noisy_ = other.noisy_;
+			count_ = std::exchange(other.count_, 0);
 		}
 
-		return os;
+		return *this;
 	}
 
-	Qubit::Qubit(QubitSystem &system) : system_(system)
+	QubitSystem QubitSystem::fork() const
+	{
+		QubitSystem f(state_->fork(), backend_);
+		f.noise_ = noise_;
+		f.truncation_ = truncation_;
+		f.noisy_ = noisy_;
+		f.count_ = count_;
+
+		return f;
+	}
+
+	BackendReport QubitSystem::report() const
+	{
+		return state_->report();
+	}
+
+	void QubitSystem::set_truncation(const Truncation &truncation)
+	{
+		truncation_ = truncation;
+		state_->set_truncation(truncation);
+	}
+
+	void QubitSystem::reset()
 	{
-		Ket &k = system.state_->get();
+		state_->reset();
+	}
 
-		if (system.count() == 0)
-			k = ZERO;
-		else
-			k = kronecker_product(ZERO, k);
+	std::ostream& operator<<(std::ostream& os, const QubitSystem &system)
+	{
+		system.state_->print(os, system.count());
+		return os;
+	}
 
+	Qubit::Qubit(QubitSystem &system) : system_(system)
+	{
+		system.state_->add_qubit();
 		index_ = system.count_++;
 	}
 
@@ -0,0 +1,119 @@
+/**
+ * @file Random.cpp
+ *
+ * Implements the counter-based random number generator.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Core.h"
+
+namespace qlay
+{
+	namespace
+	{
+		const std::uint32_t PHILOX_M0 = 0xD2511F53;
+		const std::uint32_t PHILOX_M1 = 0xCD9E8D57;
+		const std::uint32_t PHILOX_W0 = 0x9E3779B9;
+		const std::uint32_t PHILOX_W1 = 0xBB67AE85;
+
+		//Runs the ten Philox rounds over W independent counters at once, in
+		//structure-of-arrays form so that the compiler can vectorise across lanes
+		template <int W>
+		void philox_rounds(std::uint32_t (&c)[4][W], std::uint64_t key)
+		{
+			std::uint32_t k0 = static_cast<std::uint32_t>(key);
+			std::uint32_t k1 = static_cast<std::uint32_t>(key >> 32);
+
+			for (int round = 0; round < 10; round++)
+			{
+				for (int w = 0; w < W; w++)
+				{
+					std::uint64_t p0 = static_cast<std::uint64_t>(PHILOX_M0) * c[0][w];
+					std::uint64_t p1 = static_cast<std::uint64_t>(PHILOX_M1) * c[2][w];
+
+					std::uint32_t c1 = c[1][w], c3 = c[3][w];
+					c[0][w] = static_cast<std::uint32_t>(p1 >> 32) ^ c1 ^ k0;
+					c[1][w] = static_cast<std::uint32_t>(p1);
+					c[2][w] = static_cast<std::uint32_t>(p0 >> 32) ^ c3 ^ k1;
+					c[3][w] = static_cast<std::uint32_t>(p0);
+				}
+
+				k0 += PHILOX_W0;
+				k1 += PHILOX_W1;
+			}
+		}
+
+		//Loads W consecutive counters starting at the given position
+		template <int W>
+		void load_counters(std::uint32_t (&c)[4][W], std::uint64_t position, std::uint64_t stream)
+		{
+			for (int w = 0; w < W; w++)
+			{
+				c[0][w] = static_cast<std::uint32_t>(position + w);
+				c[1][w] = static_cast<std::uint32_t>((position + w) >> 32);
+				c[2][w] = static_cast<std::uint32_t>(stream);
+				c[3][w] = static_cast<std::uint32_t>(stream >> 32);
+			}
+		}
+
+		//Converts two 32-bit words into a double in [0, 1) with 53 random bits
+		inline double to_uniform(std::uint32_t a, std::uint32_t b)
+		{
+			return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+		}
+	}
+
+	void Philox::refill()
+	{
+		//128-bit counter: position in the low words, stream in the high words
+		std::uint32_t c[4][1];
+		load_counters(c, position_, stream_);
+		philox_rounds(c, key_);
+
+		for (int i = 0; i < 4; i++)
+			buffer_[i] = c[i][0];
+
+		position_++;
+		used_ = 0;
+	}
+
+	void Philox::fill_uniform(double *out, std::size_t n)
+	{
+		//Each counter block yields two doubles
+		const int LANES = 8;
+		std::uint32_t c[4][LANES];
+
+		while (n >= 2 * LANES)
+		{
+			load_counters(c, position_, stream_);
+			philox_rounds(c, key_);
+
+			for (int w = 0; w < LANES; w++)
+			{
+				out[2 * w] = to_uniform(c[0][w], c[1][w]);
+				out[2 * w + 1] = to_uniform(c[2][w], c[3][w]);
+			}
+
+			position_ += LANES;
+			out += 2 * LANES;
+			n -= 2 * LANES;
+		}
+
+		//Tail, one block at a time
+		while (n > 0)
+		{
+			std::uint32_t t[4][1];
+			load_counters(t, position_, stream_);
+			philox_rounds(t, key_);
+			position_++;
+
+			*out++ = to_uniform(t[0][0], t[1][0]);
+			if (--n > 0)
+			{
+				*out++ = to_uniform(t[2][0], t[3][0]);
+				n--;
+			}
+		}
+	}
+}
@@ -0,0 +1,60 @@
+/**
+ * @file Sampling.cpp
+ *
+ * Implements non-destructive sampling of measurement outcomes.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Core.h"
+
+#include <numeric>
+
+namespace qlay
+{
+	std::vector<Bitstring> QubitSystem::sample(unsigned shots) const
+	{
+		std::vector<int> indices(count_);
+		std::iota(indices.begin(), indices.end(), 0);
+
+		return sample(shots, indices);
+	}
+
+	std::vector<Bitstring> QubitSystem::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		check_register(indices, count_);
+		return state_->sample(shots, indices);
+	}
+
+	std::vector<Bitstring> State::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		if (indices.size() <= MAX_SAMPLE_TABLE)
+			return sample_marginal(shots, indices);
+
+		//Too many outcomes for a table: measure a fresh fork for each shot, one qubit at a time
+		std::vector<Bitstring> results(shots);
+		for (unsigned i = 0; i < shots; i++)
+			results[i] = fork()->measure(indices);
+
+		return results;
+	}
+
+	std::vector<Bitstring> State::sample_marginal(unsigned shots, const std::vector<int> &indices) const
+	{
+		//Marginalise the outcome probabilities onto the chosen qubits
+		std::vector<double> p = marginal(indices);
+
+		//One pass to build the table, then constant time per shot
+		AliasTable table(p);
+
+		//Draw all the uniforms in bulk, then map each through the table
+		std::vector<double> u(shots);
+		rng.fill_uniform(u.data(), u.size());
+
+		std::vector<Bitstring> results(shots);
+		for (unsigned i = 0; i < shots; i++)
+			results[i] = table(u[i]);
+
+		return results;
+	}
+}
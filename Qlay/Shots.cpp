@@ -0,0 +1,64 @@
+/**
+ * @file Shots.cpp
+ *
+ * Implements the shot-parallel experiment runner.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Core.h"
+
+#include <atomic>
+#include <exception>
+
+namespace qlay
+{
+	void for_each_shot(unsigned n, const std::function<void(QubitSystem &qs, unsigned shot)> &fn, Backend backend)
+	{
+		//Every shot gets its own stream under a key drawn from the caller's stream,
+		//so results depend only on init(seed), never on the thread count or schedule.
+		//The halves are drawn in separate statements to fix their order.
+		std::uint64_t hi = rng();
+		std::uint64_t lo = rng();
+		std::uint64_t key = (hi << 32) | lo;
+		Philox caller = rng;
+
+		//Exceptions cannot leave the parallel loop, so the one from the lowest numbered
+		//failing shot is kept and rethrown after it, and shots not yet started are skipped
+		std::exception_ptr error;
+		int error_shot = 0;
+		std::atomic<bool> failed(false);
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int shot = 0; shot < static_cast<int>(n); shot++)
+		{
+			if (failed.load(std::memory_order_relaxed))
+				continue;
+
+			rng.seed_stream(key, static_cast<std::uint64_t>(shot));
+
+			try
+			{
+				QubitSystem qs(backend);
+				fn(qs, static_cast<unsigned>(shot));
+			}
+			catch (...)
+			{
+				#pragma omp critical(qlay_shot_error)
+				if (!error || shot < error_shot)
+				{
+					error = std::current_exception();
+					error_shot = shot;
+				}
+
+				failed = true;
+			}
+		}
+
+		//The calling thread doubles as a worker, so restore its stream
+		rng = caller;
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+}
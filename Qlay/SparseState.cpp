@@ -0,0 +1,464 @@
+/**
+ * @file SparseState.cpp
+ *
+ * Implements the sparse state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "SparseState.h"
+
+#include <map>
+#include <stdexcept>
+
+namespace qlay
+{
+	namespace
+	{
+		//Converts to dense once this fraction of amplitudes are nonzero, as each
+		//stored entry costs several times as much as a dense amplitude
+		constexpr double DENSE_FILL = 0.25;
+
+		//Converts back to sparse once the fraction of nonzero amplitudes falls below this
+		constexpr double SPARSE_FILL = 1.0 / 16;
+
+		//Amplitudes smaller than this in magnitude are treated as having cancelled out
+		constexpr double NEGLIGIBLE = 1e-28;
+	}
+
+	AmplitudeMap::AmplitudeMap(std::size_t expected)
+	{
+		//Keep the load factor at most one half
+		std::size_t capacity = 4;
+		while (capacity < 2 * expected)
+			capacity *= 2;
+
+		keys_.resize(capacity);
+		values_.resize(capacity);
+		used_.resize(capacity, 0);
+	}
+
+	void AmplitudeMap::grow()
+	{
+		AmplitudeMap larger(2 * capacity());
+		for_each([&](Bitstring key, Complex value) { larger.add(key, value); });
+		*this = std::move(larger);
+	}
+
+	void AmplitudeMap::add(Bitstring key, Complex value)
+	{
+		if (2 * (size_ + 1) > capacity())
+			grow();
+
+		std::size_t i = slot(key);
+		if (used_[i])
+		{
+			values_[i] += value;
+			return;
+		}
+
+		used_[i] = 1;
+		keys_[i] = key;
+		values_[i] = value;
+		size_++;
+	}
+
+	void AmplitudeMap::scale(Complex factor)
+	{
+		for (std::size_t i = 0; i < keys_.size(); i++)
+			if (used_[i])
+				values_[i] *= factor;
+	}
+
+	SparseState::SparseState()
+	{
+		map_.add(0, 1);
+	}
+
+	SparseState::SparseState(AmplitudeMap map, int count) : map_(std::move(map)), count_(count)
+	{
+		rebalance();
+	}
+
+	void SparseState::rebalance()
+	{
+		//Indices must fit a Bitstring either way
+		if (count_ >= 63)
+			return;
+
+		double dim = static_cast<double>(Bitstring(1) << count_);
+
+		if (!is_dense_ && map_.size() > DENSE_FILL * dim)
+		{
+			Ket v = Ket::Zero(static_cast<Eigen::Index>(dim));
+			map_.for_each([&](Bitstring key, Complex value) { v(static_cast<Eigen::Index>(key)) = value; });
+
+			dense_ = StateVector(std::move(v), count_);
+			map_ = AmplitudeMap();
+			is_dense_ = true;
+		}
+		else if (is_dense_)
+		{
+			const Ket &v = dense_.get();
+
+			std::size_t nonzero = 0;
+			for (Eigen::Index i = 0; i < v.size(); i++)
+				if (std::norm(v(i)) > NEGLIGIBLE)
+					nonzero++;
+
+			if (nonzero >= SPARSE_FILL * dim)
+				return;
+
+			AmplitudeMap map(nonzero);
+			for (Eigen::Index i = 0; i < v.size(); i++)
+				if (std::norm(v(i)) > NEGLIGIBLE)
+					map.add(static_cast<Bitstring>(i), v(i));
+
+			map_ = std::move(map);
+			dense_ = StateVector();
+			is_dense_ = false;
+		}
+	}
+
+	AmplitudeMap SparseState::transform(const Mat &m, const std::vector<int> &bits) const
+	{
+		//Member g of a group sets bit j of g at the j-th qubit counting from the last
+		const std::size_t k = bits.size();
+		const std::size_t members = std::size_t(1) << k;
+
+		Bitstring all = 0;
+		for (int b : bits)
+			all |= Bitstring(1) << b;
+
+		auto member = [&](Bitstring base, std::size_t g)
+		{
+			for (std::size_t j = 0; j < k; j++)
+				if ((g >> j) & 1)
+					base |= Bitstring(1) << bits[k - 1 - j];
+			return base;
+		};
+
+		AmplitudeMap result(members * map_.size());
+		std::vector<Complex> in(members), out(members);
+
+		map_.for_each([&](Bitstring key, Complex)
+		{
+			Bitstring base = key & ~all;
+
+			//Only the first stored member of each group processes it
+			for (std::size_t g = 0; g < members; g++)
+			{
+				Bitstring other = member(base, g);
+				if (other == key)
+					break;
+				if (map_.get(other) != Complex(0))
+					return;
+			}
+
+			for (std::size_t g = 0; g < members; g++)
+				in[g] = map_.get(member(base, g));
+
+			for (std::size_t r = 0; r < members; r++)
+			{
+				out[r] = 0;
+				for (std::size_t g = 0; g < members; g++)
+					out[r] += m(r, g) * in[g];
+
+				if (std::norm(out[r]) > NEGLIGIBLE)
+					result.add(member(base, r), out[r]);
+			}
+		});
+
+		return result;
+	}
+
+	void SparseState::add_qubit()
+	{
+		//Basis states are keyed by a Bitstring, so a further qubit would alias a lower one
+		if (count_ >= 64)
+			throw std::length_error("Sparse backend cannot index more than 64 qubits");
+
+		//The new most significant bit is zero in every stored index
+		if (is_dense_)
+			dense_.add_qubit();
+
+		count_++;
+	}
+
+	void SparseState::reset()
+	{
+		map_ = AmplitudeMap();
+		map_.add(0, 1);
+		dense_ = StateVector();
+		is_dense_ = false;
+	}
+
+	void SparseState::apply(const Mat &m, int q)
+	{
+		if (is_dense_)
+			return dense_.apply(m, q);
+
+		map_ = transform(m, { q });
+		rebalance();
+	}
+
+	void SparseState::apply(const Mat &m, int a, int b)
+	{
+		if (is_dense_)
+			return dense_.apply(m, a, b);
+
+		map_ = transform(m, { a, b });
+		rebalance();
+	}
+
+	void SparseState::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		if (is_dense_)
+		{
+			dense_.apply_channel(kraus, q);
+			return rebalance();
+		}
+
+		//Unravel the channel: pick one Kraus operator with probability ||K|psi>||^2
+		double u = rng.uniform();
+
+		AmplitudeMap chosen;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			AmplitudeMap candidate = transform(kraus[k], { q });
+
+			double pk = 0;
+			candidate.for_each([&](Bitstring, Complex value) { pk += std::norm(value); });
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = std::move(candidate);
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		map_ = std::move(chosen);
+		map_.scale(1 / std::sqrt(p));
+	}
+
+	double SparseState::probability(int q) const
+	{
+		if (is_dense_)
+			return dense_.probability(q);
+
+		double p = 0;
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			if ((key >> q) & 1)
+				p += std::norm(value);
+		});
+
+		return p;
+	}
+
+	double SparseState::probability(Bitstring outcome) const
+	{
+		if (is_dense_)
+			return dense_.probability(outcome);
+
+		return std::norm(map_.get(outcome));
+	}
+
+	std::vector<double> SparseState::marginal(const std::vector<int> &indices) const
+	{
+		if (is_dense_)
+			return dense_.marginal(indices);
+
+		std::vector<double> prob(Bitstring(1) << indices.size(), 0.0);
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			prob[gather_bits(static_cast<Eigen::Index>(key), indices)] += std::norm(value);
+		});
+
+		return prob;
+	}
+
+	void SparseState::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		if (is_dense_)
+		{
+			dense_.collapse(indices, outcome, p);
+			return rebalance();
+		}
+
+		const double scale = 1 / std::sqrt(p);
+
+		AmplitudeMap kept(map_.size());
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			if (gather_bits(static_cast<Eigen::Index>(key), indices) == outcome)
+				kept.add(key, value * scale);
+		});
+
+		map_ = std::move(kept);
+	}
+
+	Bitstring SparseState::measure(const std::vector<int> &indices)
+	{
+		if (is_dense_)
+		{
+			Bitstring result = dense_.measure(indices);
+			rebalance();
+			return result;
+		}
+
+		//Draw one stored basis state, rather than building all 2^k joint outcomes
+		double u = rng.uniform();
+
+		Bitstring chosen = 0;
+		double acc = 0;
+		bool found = false;
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			if (found)
+				return;
+
+			//Fall back on the last entry should rounding leave u unmatched
+			chosen = key;
+			acc += std::norm(value);
+			found = u < acc;
+		});
+
+		Bitstring result = gather_bits(static_cast<Eigen::Index>(chosen), indices);
+
+		double p = 0;
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			if (gather_bits(static_cast<Eigen::Index>(key), indices) == result)
+				p += std::norm(value);
+		});
+
+		collapse(indices, result, p);
+		return result;
+	}
+
+	std::vector<Bitstring> SparseState::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		if (is_dense_)
+			return dense_.sample(shots, indices);
+
+		//Build the alias table over stored basis states, mapping each draw onto the chosen qubits
+		std::vector<Bitstring> keys;
+		std::vector<double> weights;
+		keys.reserve(map_.size());
+		weights.reserve(map_.size());
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			keys.push_back(gather_bits(static_cast<Eigen::Index>(key), indices));
+			weights.push_back(std::norm(value));
+		});
+
+		AliasTable table(weights);
+
+		std::vector<double> u(shots);
+		rng.fill_uniform(u.data(), u.size());
+
+		std::vector<Bitstring> results(shots);
+		for (unsigned i = 0; i < shots; i++)
+			results[i] = keys[table(u[i])];
+
+		return results;
+	}
+
+	double SparseState::expectation(const PauliString &p) const
+	{
+		if (is_dense_)
+			return dense_.expectation(p);
+
+		Bitstring x = p.x_mask();
+		Bitstring z = p.z_mask();
+
+		//P|j> = i^(#Y) (-1)^(popcount(j & z)) |j ^ x>, so only stored partners contribute
+		Complex sum = 0;
+		map_.for_each([&](Bitstring key, Complex value)
+		{
+			Complex term = std::conj(map_.get(key ^ x)) * value;
+			sum += parity(key & z) ? -term : term;
+		});
+
+		return (pauli_phase(p) * sum).real();
+	}
+
+	void SparseState::print(std::ostream &os, int count) const
+	{
+		if (is_dense_)
+			return dense_.print(os, count);
+
+		//Print each stored coefficient in order of basis state
+		std::map<Bitstring, Complex> sorted;
+		map_.for_each([&](Bitstring key, Complex value) { sorted[key] = value; });
+
+		for (const auto &entry : sorted)
+		{
+			//Format basis vector as binary number
+			os << "|";
+			for (int j = count; j > 0; j--)
+				os << ((entry.first >> (j-1)) & 1);
+			os << "> ";
+
+			print_complex(os, entry.second);
+			os << std::endl;
+		}
+	}
+
+	BackendReport SparseState::report() const
+	{
+		if (is_dense_)
+		{
+			BackendReport r = dense_.report();
+			r.backend = Backend::Sparse;
+			r.reason = "Chosen explicitly; stored densely while most amplitudes are nonzero";
+			return r;
+		}
+
+		double slot = sizeof(Bitstring) + sizeof(Complex) + 1;
+		return { Backend::Sparse, map_.capacity() * slot, static_cast<double>(map_.size()), "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> SparseState::fork() const
+	{
+		return std::make_unique<SparseState>(*this);
+	}
+
+	void SparseState::save(std::ostream &os) const
+	{
+		if (is_dense_)
+			return dense_.save(os);
+
+		if (count_ >= 63)
+			throw std::length_error("Too many qubits to save every amplitude");
+
+		//Written a buffer at a time, looking up each amplitude in turn
+		const Bitstring size = Bitstring(1) << count_;
+		std::vector<Complex> buffer(static_cast<std::size_t>(std::min<Bitstring>(size, 4096)));
+		for (Bitstring base = 0; base < size; base += buffer.size())
+		{
+			for (std::size_t k = 0; k < buffer.size(); k++)
+				buffer[k] = map_.get(base + k);
+
+			os.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(Complex));
+		}
+	}
+
+	void SparseState::load(const Complex *v, int count, const std::vector<int> &layout)
+	{
+		//Start dense, then convert should few amplitudes be nonzero
+		dense_.load(v, count, layout);
+		map_ = AmplitudeMap();
+		is_dense_ = true;
+		count_ = count;
+
+		rebalance();
+	}
+}
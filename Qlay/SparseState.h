@@ -0,0 +1,121 @@
+/**
+ * @file SparseState.h
+ *
+ * Internal header defining the sparse state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "StateVector.h"
+
+namespace qlay
+{
+	//Open-addressing hash table from basis index to amplitude, probing linearly
+	class AmplitudeMap
+	{
+	private:
+		std::vector<Bitstring> keys_;
+		std::vector<Complex> values_;
+		std::vector<unsigned char> used_;
+		std::size_t size_ = 0;
+
+		//Returns the slot holding key, or the empty slot where it belongs
+		std::size_t slot(Bitstring key) const
+		{
+			//Mix the bits so that neighbouring indices spread across the table
+			Bitstring h = key ^ (key >> 33);
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+
+			std::size_t mask = keys_.size() - 1;
+			std::size_t i = static_cast<std::size_t>(h) & mask;
+			while (used_[i] && keys_[i] != key)
+				i = (i + 1) & mask;
+
+			return i;
+		}
+
+		//Doubles the capacity, reinserting every entry
+		void grow();
+
+	public:
+		//Prepares an empty table with room for the given number of entries
+		explicit AmplitudeMap(std::size_t expected = 1);
+
+		//Returns the number of entries
+		std::size_t size() const { return size_; }
+
+		//Returns the number of slots
+		std::size_t capacity() const { return keys_.size(); }
+
+		//Returns the amplitude of the given basis index, zero if absent
+		Complex get(Bitstring key) const
+		{
+			std::size_t i = slot(key);
+			return used_[i] ? values_[i] : Complex(0);
+		}
+
+		//Adds value to the amplitude of the given basis index
+		void add(Bitstring key, Complex value);
+
+		//Calls f(key, value) for every entry
+		template <typename F>
+		void for_each(F f) const
+		{
+			for (std::size_t i = 0; i < keys_.size(); i++)
+				if (used_[i])
+					f(keys_[i], values_[i]);
+		}
+
+		//Multiplies every amplitude by the given factor
+		void scale(Complex factor);
+	};
+
+	//State vector storing only nonzero amplitudes, so that states spanning few
+	//basis states cost memory and time in proportion to their support. Converts
+	//itself to a dense StateVector once filled, and back again once emptied.
+	class SparseState : public State
+	{
+	private:
+		AmplitudeMap map_;
+		StateVector dense_;
+		bool is_dense_ = false;
+		int count_ = 0;
+
+		//Switches representation if the number of nonzero amplitudes has crossed a threshold
+		void rebalance();
+
+		//Returns the map after applying m to each group of basis states differing in the given bits
+		AmplitudeMap transform(const Mat &m, const std::vector<int> &bits) const;
+
+	public:
+		SparseState();
+
+		//Adopts the given nonzero amplitudes of a count-qubit state
+		SparseState(AmplitudeMap map, int count);
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+
+		void save(std::ostream &os) const override;
+		void load(const Complex *v, int count, const std::vector<int> &layout) override;
+	};
+}
@@ -0,0 +1,659 @@
+/**
+ * @file Stabilizer.cpp
+ *
+ * Implements the stabilizer tableau backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Stabilizer.h"
+#include "SparseState.h"
+
+#include <stdexcept>
+
+namespace qlay
+{
+	namespace
+	{
+		const std::uint64_t ALL = ~std::uint64_t(0);
+
+		//Even bits select destabilizer rows, odd bits stabilizer rows
+		const std::uint64_t DESTABILIZERS = 0x5555555555555555;
+		const std::uint64_t STABILIZERS   = 0xAAAAAAAAAAAAAAAA;
+
+		const double TOLERANCE = 1e-9;
+
+		//Single-qubit Pauli by code (bit 0 = X part, bit 1 = Z part): I, X, Z, Y
+		Mat pauli(unsigned code)
+		{
+			switch (code & 3)
+			{
+			case 1:  return PAULI_X;
+			case 2:  return PAULI_Z;
+			case 3:  return PAULI_Y;
+			default: return Mat::Identity(2, 2);
+			}
+		}
+
+		//Pauli string by code over the given number of qubits, first qubit high-order
+		Mat pauli(unsigned code, int qubits)
+		{
+			return qubits == 1 ? pauli(code) : kronecker_product(pauli(code >> 2), pauli(code));
+		}
+
+		//Exponent of i in the product of single-qubit Paulis (x1,z1)(x2,z2)
+		int g(bool x1, bool z1, bool x2, bool z2)
+		{
+			if (x1 && z1) return int(z2) - int(x2);
+			if (x1)       return int(z2) * (2 * int(x2) - 1);
+			if (z1)       return int(x2) * (1 - 2 * int(z2));
+			return 0;
+		}
+
+		//Returns the index of the lowest set bit of a nonzero word
+		inline int lowest_bit(std::uint64_t w)
+		{
+			int i = 0;
+			for (; !(w & 1); w >>= 1)
+				i++;
+
+			return i;
+		}
+
+		//Selects the rows whose Pauli on some qubit has the given code
+		inline std::uint64_t select(std::uint64_t x, std::uint64_t z, unsigned code)
+		{
+			return (code & 1 ? x : ~x) & (code & 2 ? z : ~z);
+		}
+	}
+
+	void Stabilizer::set(Bits &b, int row, bool value)
+	{
+		std::uint64_t mask = std::uint64_t(1) << (row & 63);
+		b[row >> 6] = value ? b[row >> 6] | mask : b[row >> 6] & ~mask;
+	}
+
+	const Stabilizer::CliffordTable &Stabilizer::classify(const Mat &m, int qubits)
+	{
+		for (const CliffordTable &t : cache_)
+			if (t.m.rows() == m.rows() && (t.m - m).cwiseAbs().maxCoeff() < TOLERANCE)
+				return t;
+
+		CliffordTable t;
+		t.m = m;
+		t.image[0] = 0;
+		t.negate[0] = false;
+
+		//Conjugate every non-identity Pauli and recognise the result as +/- a Pauli
+		unsigned codes = 1u << (2 * qubits);
+		double dim = static_cast<double>(m.rows());
+		for (unsigned code = 1; code < codes; code++)
+		{
+			Mat image = m * pauli(code, qubits) * m.adjoint();
+
+			bool found = false;
+			for (unsigned c = 1; c < codes && !found; c++)
+			{
+				Mat q = pauli(c, qubits);
+				Complex overlap = (q.adjoint() * image).trace() / dim;
+
+				if (std::abs(std::abs(overlap.real()) - 1) < TOLERANCE && std::abs(overlap.imag()) < TOLERANCE
+					&& (image - overlap.real() * q).cwiseAbs().maxCoeff() < TOLERANCE)
+				{
+					t.image[code] = c;
+					t.negate[code] = overlap.real() < 0;
+					found = true;
+				}
+			}
+
+			if (!found)
+				throw std::domain_error("Stabilizer backend only supports Clifford gates");
+		}
+
+		//Gate streams reuse few distinct matrices, so keep the cache small
+		if (cache_.size() == 16)
+			cache_.erase(cache_.begin());
+		cache_.push_back(t);
+
+		return cache_.back();
+	}
+
+	void Stabilizer::add_qubit()
+	{
+		int n = count_++;
+		std::size_t w = (2 * count_ + 63) / 64;
+
+		for (Bits &b : x_) b.resize(w, 0);
+		for (Bits &b : z_) b.resize(w, 0);
+		r_.resize(w, 0);
+
+		//New destabilizer X_n and stabilizer Z_n
+		x_.emplace_back(w, 0);
+		z_.emplace_back(w, 0);
+		set(x_[n], 2 * n, true);
+		set(z_[n], 2 * n + 1, true);
+	}
+
+	void Stabilizer::reset()
+	{
+		for (int j = 0; j < count_; j++)
+		{
+			std::fill(x_[j].begin(), x_[j].end(), 0);
+			std::fill(z_[j].begin(), z_[j].end(), 0);
+			set(x_[j], 2 * j, true);
+			set(z_[j], 2 * j + 1, true);
+		}
+
+		std::fill(r_.begin(), r_.end(), 0);
+	}
+
+	void Stabilizer::apply(const Mat &m, int q)
+	{
+		const CliffordTable &t = classify(m, 1);
+
+		std::uint64_t tx[4], tz[4], tn[4];
+		for (unsigned c = 0; c < 4; c++)
+		{
+			tx[c] = t.image[c] & 1 ? ALL : 0;
+			tz[c] = t.image[c] & 2 ? ALL : 0;
+			tn[c] = t.negate[c] ? ALL : 0;
+		}
+
+		Bits &xq = x_[q], &zq = z_[q];
+		for (std::size_t w = 0; w < words(); w++)
+		{
+			std::uint64_t is_x = select(xq[w], zq[w], 1);
+			std::uint64_t is_z = select(xq[w], zq[w], 2);
+			std::uint64_t is_y = select(xq[w], zq[w], 3);
+
+			xq[w] = (is_x & tx[1]) | (is_z & tx[2]) | (is_y & tx[3]);
+			zq[w] = (is_x & tz[1]) | (is_z & tz[2]) | (is_y & tz[3]);
+			r_[w] ^= (is_x & tn[1]) | (is_z & tn[2]) | (is_y & tn[3]);
+		}
+	}
+
+	void Stabilizer::apply(const Mat &m, int a, int b)
+	{
+		const CliffordTable &t = classify(m, 2);
+
+		Bits &xa = x_[a], &za = z_[a], &xb = x_[b], &zb = z_[b];
+		for (std::size_t w = 0; w < words(); w++)
+		{
+			std::uint64_t nxa = 0, nza = 0, nxb = 0, nzb = 0, neg = 0;
+
+			//Sum over the fifteen non-identity two-qubit Paulis present in these rows
+			for (unsigned code = 1; code < 16; code++)
+			{
+				std::uint64_t rows = select(xa[w], za[w], code >> 2) & select(xb[w], zb[w], code & 3);
+				unsigned image = t.image[code];
+
+				if (image & 4) nxa |= rows;
+				if (image & 8) nza |= rows;
+				if (image & 1) nxb |= rows;
+				if (image & 2) nzb |= rows;
+				if (t.negate[code]) neg |= rows;
+			}
+
+			xa[w] = nxa; za[w] = nza;
+			xb[w] = nxb; zb[w] = nzb;
+			r_[w] ^= neg;
+		}
+	}
+
+	void Stabilizer::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//Only mixtures of Paulis keep the state a stabilizer state, so check
+		//every operator is a scaled Pauli before touching the tableau
+		std::vector<std::pair<unsigned, double>> terms;
+		for (const Mat &k : kraus)
+		{
+			bool found = false;
+			for (unsigned c = 0; c < 4 && !found; c++)
+			{
+				Complex overlap = (pauli(c).adjoint() * k).trace() / 2.0;
+				if ((k - overlap * pauli(c)).cwiseAbs().maxCoeff() < TOLERANCE)
+				{
+					terms.emplace_back(c, std::norm(overlap));
+					found = true;
+				}
+			}
+
+			if (!found)
+				throw std::domain_error("Stabilizer backend only supports Pauli noise channels");
+		}
+
+		//Pauli probabilities do not depend on the state, so sample one directly
+		double u = rng.uniform(), acc = 0;
+		for (const auto &term : terms)
+		{
+			acc += term.second;
+			if (u < acc)
+			{
+				if (term.first != 0)
+					apply(pauli(term.first), q);
+				return;
+			}
+		}
+	}
+
+	void Stabilizer::rowsum_all(const Bits &mask, int p)
+	{
+		//Per-row phase exponents modulo 4, as two bit planes
+		Bits c0(words(), 0), c1(words(), 0);
+
+		for (int j = 0; j < count_; j++)
+		{
+			bool xp = bit(x_[j], p), zp = bit(z_[j], p);
+			if (!xp && !zp)
+				continue;
+
+			for (std::size_t w = 0; w < words(); w++)
+			{
+				std::uint64_t x2 = x_[j][w], z2 = z_[j][w];
+				std::uint64_t plus, minus;
+
+				//g(xp, zp, x2, z2) is +1 on plus rows and -1 on minus rows
+				if (xp && zp)  { plus = ~x2 & z2; minus = x2 & ~z2; }
+				else if (xp)   { plus = x2 & z2;  minus = ~x2 & z2; }
+				else           { plus = x2 & ~z2; minus = x2 & z2;  }
+
+				plus &= mask[w];
+				minus &= mask[w];
+
+				c1[w] ^= c0[w] & plus;
+				c0[w] ^= plus;
+				c1[w] ^= ~c0[w] & minus;
+				c0[w] ^= minus;
+
+				if (xp) x_[j][w] ^= mask[w];
+				if (zp) z_[j][w] ^= mask[w];
+			}
+		}
+
+		//New sign is (2r_h + 2r_p + sum g) / 2 modulo 2
+		std::uint64_t rp = bit(r_, p) ? ALL : 0;
+		for (std::size_t w = 0; w < words(); w++)
+			r_[w] ^= mask[w] & (c1[w] ^ rp);
+	}
+
+	bool Stabilizer::product_sign(const std::vector<int> &rows) const
+	{
+		std::vector<char> x(count_, 0), z(count_, 0);
+		int phase = 0;
+
+		for (int row : rows)
+		{
+			phase += 2 * bit(r_, row);
+			for (int j = 0; j < count_; j++)
+			{
+				bool xr = bit(x_[j], row), zr = bit(z_[j], row);
+				phase += g(xr, zr, x[j], z[j]);
+				x[j] ^= xr;
+				z[j] ^= zr;
+			}
+		}
+
+		return ((phase % 4) + 4) % 4 == 2;
+	}
+
+	bool Stabilizer::is_random(int q, bool &outcome) const
+	{
+		//Random exactly when some stabilizer anticommutes with Z_q
+		std::vector<int> rows;
+		for (std::size_t w = 0; w < words(); w++)
+		{
+			if (x_[q][w] & STABILIZERS)
+				return true;
+
+			//Otherwise Z_q is the product of the stabilizers paired with these destabilizers
+			for (std::uint64_t d = x_[q][w] & DESTABILIZERS; d; d &= d - 1)
+				rows.push_back(static_cast<int>(w * 64) + lowest_bit(d) + 1);
+		}
+
+		outcome = product_sign(rows);
+		return false;
+	}
+
+	bool Stabilizer::measure_qubit(int q, bool outcome)
+	{
+		//Find a stabilizer anticommuting with Z_q
+		int p = -1;
+		for (int i = 0; i < count_ && p < 0; i++)
+			if (bit(x_[q], 2 * i + 1))
+				p = 2 * i + 1;
+
+		if (p < 0)
+		{
+			bool determined;
+			is_random(q, determined);
+			return determined;
+		}
+
+		//Multiply every other anticommuting row by row p
+		Bits mask = x_[q];
+		set(mask, p, false);
+		rowsum_all(mask, p);
+
+		//Row p becomes the paired destabilizer, and Z_q with the outcome's sign replaces it
+		for (int j = 0; j < count_; j++)
+		{
+			set(x_[j], p - 1, bit(x_[j], p));
+			set(z_[j], p - 1, bit(z_[j], p));
+			set(x_[j], p, false);
+			set(z_[j], p, j == q);
+		}
+		set(r_, p - 1, bit(r_, p));
+		set(r_, p, outcome);
+
+		return outcome;
+	}
+
+	double Stabilizer::probability(int q) const
+	{
+		bool outcome;
+		if (is_random(q, outcome))
+			return 0.5;
+
+		return outcome ? 1.0 : 0.0;
+	}
+
+	double Stabilizer::probability(Bitstring outcome) const
+	{
+		Stabilizer s = *this;
+		double p = 1;
+
+		for (int q = 0; q < count_; q++)
+		{
+			bool wanted = (outcome >> q) & 1;
+			bool determined;
+
+			if (s.is_random(q, determined))
+			{
+				p /= 2;
+				s.measure_qubit(q, wanted);
+			}
+			else if (determined != wanted)
+				return 0;
+		}
+
+		return p;
+	}
+
+	std::vector<double> Stabilizer::marginal(const std::vector<int> &indices) const
+	{
+		std::vector<double> p(std::size_t(1) << indices.size(), 0.0);
+
+		//Branch on each random qubit in turn
+		std::function<void(Stabilizer &, std::size_t, Bitstring, double)> branch =
+			[&](Stabilizer &s, std::size_t i, Bitstring prefix, double prob)
+		{
+			if (i == indices.size())
+			{
+				p[prefix] += prob;
+				return;
+			}
+
+			bool determined;
+			if (!s.is_random(indices[i], determined))
+				return branch(s, i + 1, prefix | (Bitstring(determined) << i), prob);
+
+			Stabilizer one = s;
+			one.measure_qubit(indices[i], true);
+			branch(one, i + 1, prefix | (Bitstring(1) << i), prob / 2);
+
+			s.measure_qubit(indices[i], false);
+			branch(s, i + 1, prefix, prob / 2);
+		};
+
+		Stabilizer s = *this;
+		branch(s, 0, 0, 1.0);
+
+		return p;
+	}
+
+	void Stabilizer::collapse(const std::vector<int> &indices, Bitstring outcome, double)
+	{
+		for (std::size_t i = 0; i < indices.size(); i++)
+			measure_qubit(indices[i], (outcome >> i) & 1);
+	}
+
+	Bitstring Stabilizer::measure(const std::vector<int> &indices)
+	{
+		//Each random outcome is a fair coin
+		Bitstring result = 0;
+		for (std::size_t i = 0; i < indices.size(); i++)
+			result |= Bitstring(measure_qubit(indices[i], rng.uniform() < 0.5)) << i;
+
+		return result;
+	}
+
+	std::vector<Bitstring> Stabilizer::sample(unsigned shots, const std::vector<int> &indices) const
+	{
+		//Measure a fresh copy per shot; polynomial, unlike enumerating the marginal
+		std::vector<Bitstring> results(shots);
+		for (Bitstring &r : results)
+		{
+			Stabilizer s = *this;
+			r = s.measure(indices);
+		}
+
+		return results;
+	}
+
+	double Stabilizer::expectation(const PauliString &p) const
+	{
+		//Rows anticommuting with P, found a word of rows at a time
+		Bits anti(words(), 0);
+		for (int j = 0; j < count_ && j < 64; j++)
+		{
+			bool px = (p.x_mask() >> j) & 1, pz = (p.z_mask() >> j) & 1;
+			for (std::size_t w = 0; w < words(); w++)
+				anti[w] ^= (pz ? x_[j][w] : 0) ^ (px ? z_[j][w] : 0);
+		}
+
+		//P is outside the stabilizer group unless it commutes with every stabilizer
+		std::vector<int> rows;
+		for (std::size_t w = 0; w < words(); w++)
+		{
+			if (anti[w] & STABILIZERS)
+				return 0;
+
+			for (std::uint64_t d = anti[w] & DESTABILIZERS; d; d &= d - 1)
+				rows.push_back(static_cast<int>(w * 64) + lowest_bit(d) + 1);
+		}
+
+		//Then +/-P is the product of the stabilizers paired with anticommuting destabilizers
+		return product_sign(rows) ? -1.0 : 1.0;
+	}
+
+	void Stabilizer::print(std::ostream &os, int count) const
+	{
+		//Print each stabilizer generator, highest qubit first
+		static const char symbols[] = { 'I', 'X', 'Z', 'Y' };
+
+		for (int i = 0; i < count; i++)
+		{
+			int row = 2 * i + 1;
+			os << (bit(r_, row) ? '-' : '+');
+			for (int j = count - 1; j >= 0; j--)
+				os << symbols[bit(x_[j], row) | (bit(z_[j], row) << 1)];
+			os << std::endl;
+		}
+	}
+
+	BackendReport Stabilizer::report() const
+	{
+		double bits = (x_.size() + z_.size() + 1) * 64.0 * words();
+		return { Backend::Stabilizer, bits / 8, 16.0 * words(), "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> Stabilizer::fork() const
+	{
+		return std::make_unique<Stabilizer>(*this);
+	}
+
+	void Stabilizer::save(std::ostream &os) const
+	{
+		//Saved as amplitudes, so it may be loaded into any backend holding them
+		StateVector(to_ket(), count_).save(os);
+	}
+
+	Ket Stabilizer::to_ket() const
+	{
+		//Measuring a copy finds a basis state with nonzero amplitude
+		Stabilizer s = *this;
+		Eigen::Index basis = 0;
+		for (int q = 0; q < count_; q++)
+			basis |= Eigen::Index(s.measure_qubit(q, false)) << q;
+
+		Ket v = Ket::Zero(Eigen::Index(1) << count_);
+		v(basis) = 1;
+
+		//Project onto the +1 eigenspace of each stabilizer: v = (v + S v) / 2
+		for (int i = 0; i < count_; i++)
+		{
+			int row = 2 * i + 1;
+			Bitstring x = 0, z = 0;
+			for (int j = 0; j < count_; j++)
+			{
+				x |= Bitstring(bit(x_[j], row)) << j;
+				z |= Bitstring(bit(z_[j], row)) << j;
+			}
+
+			PauliString p(x, z);
+			Complex phase = pauli_phase(p) * (bit(r_, row) ? -1.0 : 1.0);
+
+			Ket sv(v.size());
+			for (Eigen::Index j = 0; j < v.size(); j++)
+				sv(static_cast<Eigen::Index>(j ^ x)) = (parity(j & z) ? -phase : phase) * v(j);
+
+			v = (v + sv) / 2.0;
+		}
+
+		v.normalize();
+		return v;
+	}
+
+	int Stabilizer::support_bits() const
+	{
+		//The amplitudes are spread over the span of the stabilizers' X parts, so
+		//count the independent ones by Gaussian elimination over GF(2)
+		const std::size_t row_words = (static_cast<std::size_t>(count_) + 63) / 64;
+		std::vector<Bits> rows(count_, Bits(row_words, 0));
+		for (int i = 0; i < count_; i++)
+			for (int j = 0; j < count_; j++)
+				if (bit(x_[j], 2 * i + 1))
+					rows[i][j >> 6] |= std::uint64_t(1) << (j & 63);
+
+		int rank = 0;
+		for (int j = 0; j < count_ && rank < count_; j++)
+		{
+			const std::size_t w = j >> 6;
+			const std::uint64_t mask = std::uint64_t(1) << (j & 63);
+
+			int pivot = rank;
+			while (pivot < count_ && !(rows[pivot][w] & mask))
+				pivot++;
+			if (pivot == count_)
+				continue;
+
+			std::swap(rows[rank], rows[pivot]);
+			for (int i = rank + 1; i < count_; i++)
+				if (rows[i][w] & mask)
+					for (std::size_t k = w; k < row_words; k++)
+						rows[i][k] ^= rows[rank][k];
+
+			rank++;
+		}
+
+		return rank;
+	}
+
+	int Stabilizer::entanglement_bits() const
+	{
+		//The entropy across a cut is the rank of the stabilizers restricted to the qubits
+		//left of it, less their number. Each qubit adds its X and Z columns, whose stabilizer
+		//rows are the odd bits of each word, to a basis reduced over GF(2).
+		const std::uint64_t stabilizer_rows = 0xAAAAAAAAAAAAAAAAULL;
+		std::vector<std::pair<std::size_t, Bits>> basis; //Lowest set bit and vector
+		int largest = 0;
+
+		for (int q = 0; q < count_; q++)
+		{
+			for (const Bits *column : { &x_[q], &z_[q] })
+			{
+				Bits v(words());
+				for (std::size_t w = 0; w < v.size(); w++)
+					v[w] = (*column)[w] & stabilizer_rows;
+
+				for (const auto &b : basis)
+					if ((v[b.first >> 6] >> (b.first & 63)) & 1)
+						for (std::size_t w = 0; w < v.size(); w++)
+							v[w] ^= b.second[w];
+
+				for (std::size_t w = 0; w < v.size(); w++)
+					if (v[w])
+					{
+						std::size_t pivot = 64 * w;
+						for (std::uint64_t word = v[w]; !(word & 1); word >>= 1)
+							pivot++;
+
+						basis.emplace_back(pivot, std::move(v));
+						break;
+					}
+			}
+
+			largest = std::max(largest, static_cast<int>(basis.size()) - (q + 1));
+		}
+
+		return largest;
+	}
+
+	AmplitudeMap Stabilizer::to_map() const
+	{
+		if (count_ > 63)
+			throw std::length_error("Too many qubits to index every amplitude");
+
+		//As for to_ket(), starting from a basis state with nonzero amplitude
+		Stabilizer s = *this;
+		Bitstring basis = 0;
+		for (int q = 0; q < count_; q++)
+			basis |= Bitstring(s.measure_qubit(q, false)) << q;
+
+		AmplitudeMap v;
+		v.add(basis, 1);
+
+		//Each projection spreads the amplitudes over the translates by the stabilizer's X
+		//part. Stabilizers without one fix every basis state of the support, so are skipped,
+		//and no amplitudes cancel, so the map never exceeds 2^support_bits() entries.
+		for (int i = 0; i < count_; i++)
+		{
+			int row = 2 * i + 1;
+			Bitstring x = 0, z = 0;
+			for (int j = 0; j < count_; j++)
+			{
+				x |= Bitstring(bit(x_[j], row)) << j;
+				z |= Bitstring(bit(z_[j], row)) << j;
+			}
+
+			if (x == 0)
+				continue;
+
+			PauliString p(x, z);
+			Complex phase = pauli_phase(p) * (bit(r_, row) ? -1.0 : 1.0);
+
+			AmplitudeMap sv(2 * v.size());
+			v.for_each([&](Bitstring j, Complex a)
+			{
+				sv.add(j, a / 2.0);
+				sv.add(j ^ x, (parity(j & z) ? -phase : phase) * a / 2.0);
+			});
+
+			v = std::move(sv);
+		}
+
+		//Every amplitude has the same magnitude
+		v.scale(1.0 / std::sqrt(static_cast<double>(v.size())) / std::abs(v.get(basis)));
+		return v;
+	}
+}
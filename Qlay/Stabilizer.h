@@ -0,0 +1,100 @@
+/**
+ * @file Stabilizer.h
+ *
+ * Internal header defining the stabilizer tableau backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+#include <utility>
+
+namespace qlay
+{
+	class AmplitudeMap;
+
+	//Aaronson-Gottesman stabilizer tableau, simulating Clifford circuits in
+	//polynomial time. Row 2i is destabilizer i and row 2i+1 stabilizer i; each
+	//qubit's X and Z bits are packed 64 rows to a word, so gates update whole
+	//words of rows at once. Gates are accepted if they are Clifford, as judged
+	//by conjugating Pauli operators through their matrices.
+	class Stabilizer : public State
+	{
+	private:
+		using Bits = std::vector<std::uint64_t>;
+
+		//Image of a Pauli under conjugation by a gate, as a two-qubit code per input code
+		struct CliffordTable
+		{
+			Mat m;
+			unsigned image[16];
+			bool negate[16];
+		};
+
+		std::vector<Bits> x_;
+		std::vector<Bits> z_;
+		Bits r_;
+		int count_ = 0;
+
+		std::vector<CliffordTable> cache_;
+
+		std::size_t words() const { return x_.empty() ? 0 : x_[0].size(); }
+
+		bool bit(const Bits &b, int row) const { return (b[row >> 6] >> (row & 63)) & 1; }
+		void set(Bits &b, int row, bool value);
+
+		//Returns the Clifford table of the given operator, throwing if it is not Clifford
+		const CliffordTable &classify(const Mat &m, int qubits);
+
+		//Multiplies every row in mask (bit-packed) by row p, tracking signs
+		void rowsum_all(const Bits &mask, int p);
+
+		//Returns whether the product of the given rows is negative
+		bool product_sign(const std::vector<int> &rows) const;
+
+		//Returns whether measuring q is random; if not, sets the determined outcome
+		bool is_random(int q, bool &outcome) const;
+
+		//Measures q with the given outcome where random, returning the actual outcome
+		bool measure_qubit(int q, bool outcome);
+
+	public:
+		//Expands the stabilizer state into its 2^n amplitudes, up to global phase
+		Ket to_ket() const;
+
+		//Returns k such that 2^k basis states have nonzero amplitude
+		int support_bits() const;
+
+		//Returns the largest entanglement entropy in bits across any cut between
+		//neighbouring qubits, so that a matrix product state needs bonds of 2^that
+		int entanglement_bits() const;
+
+		//Expands the stabilizer state into its 2^support_bits() nonzero amplitudes, up to
+		//global phase. Requires at most 63 qubits.
+		AmplitudeMap to_map() const;
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override;
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+
+		void save(std::ostream &os) const override;
+	};
+}
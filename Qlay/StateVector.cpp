@@ -0,0 +1,552 @@
+/**
+ * @file StateVector.cpp
+ *
+ * Implements the dense state vector backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "StateVector.h"
+
+#include <stdexcept>
+
+namespace qlay
+{
+	void apply_kernel(Complex *v, Eigen::Index size, const Mat &m, int q)
+	{
+		const Complex m00 = m(0, 0), m01 = m(0, 1), m10 = m(1, 0), m11 = m(1, 1);
+		const Eigen::Index mask = Eigen::Index(1) << q;
+		const Eigen::Index pairs = size / 2;
+
+		//Each pair of amplitudes differing only in bit q is independent
+		#pragma omp parallel for if(pairs >= PARALLEL_THRESHOLD)
+		for (Eigen::Index k = 0; k < pairs; k++)
+		{
+			Eigen::Index i0 = insert_zero(k, q);
+			Eigen::Index i1 = i0 | mask;
+
+			Complex a0 = v[i0], a1 = v[i1];
+			v[i0] = m00 * a0 + m01 * a1;
+			v[i1] = m10 * a0 + m11 * a1;
+		}
+	}
+
+	void apply_kernel(Complex *v, Eigen::Index size, const Mat &m, int a, int b)
+	{
+		const Eigen::Index mask_a = Eigen::Index(1) << a;
+		const Eigen::Index mask_b = Eigen::Index(1) << b;
+		const Eigen::Index quads = size / 4;
+		const int lo = std::min(a, b), hi = std::max(a, b);
+
+		#pragma omp parallel for if(quads >= PARALLEL_THRESHOLD)
+		for (Eigen::Index k = 0; k < quads; k++)
+		{
+			//Operator basis index is (bit a, bit b)
+			Eigen::Index i[4];
+			i[0] = insert_zero(insert_zero(k, lo), hi);
+			i[1] = i[0] | mask_b;
+			i[2] = i[0] | mask_a;
+			i[3] = i[0] | mask_a | mask_b;
+
+			Complex in[4] = { v[i[0]], v[i[1]], v[i[2]], v[i[3]] };
+			for (int r = 0; r < 4; r++)
+				v[i[r]] = m(r, 0) * in[0] + m(r, 1) * in[1] + m(r, 2) * in[2] + m(r, 3) * in[3];
+		}
+	}
+
+
+	StateVector::StateVector(Ket v, int count) : count_(count)
+	{
+		//Hold only the blocks of the adopted amplitudes which are not all zero
+		const Eigen::Index size = block_size();
+		blocks_.resize(static_cast<std::size_t>(v.size() >> block_bits()));
+
+		#pragma omp parallel for if(v.size() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index b = 0; b < blocks(); b++)
+			if (!v.segment(b * size, size).isZero(0))
+				blocks_[b] = std::make_shared<Ket>(v.segment(b * size, size));
+	}
+
+	const Complex *StateVector::read(Eigen::Index b) const
+	{
+		//Blocks not held read from a single block of zeros
+		static const Ket zeros = Ket::Zero(Eigen::Index(1) << ZERO_BLOCK_BITS);
+		return blocks_[b] ? blocks_[b]->data() : zeros.data();
+	}
+
+	Complex *StateVector::write(Eigen::Index b)
+	{
+		std::shared_ptr<Ket> &block = blocks_[b];
+		if (!block)
+			block = std::make_shared<Ket>(Ket::Zero(block_size()));
+		else if (block.use_count() > 1)
+			block = std::make_shared<Ket>(*block);
+
+		return block->data();
+	}
+
+	Ket StateVector::get() const
+	{
+		const Eigen::Index size = block_size();
+		Ket v(this->size());
+
+		#pragma omp parallel for if(v.size() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index b = 0; b < blocks(); b++)
+			v.segment(b * size, size) = Eigen::Map<const Ket>(read(b), size);
+
+		return v;
+	}
+
+	void StateVector::add_qubit()
+	{
+		//|0> (x) |psi> leaves the existing amplitudes in the lower half
+		if (count_ == 0)
+			blocks_.assign(1, std::make_shared<Ket>(ZERO));
+		else if (count_ < ZERO_BLOCK_BITS)
+		{
+			//The only block grows until it reaches the full size
+			Eigen::Index size = block_size();
+			write(0);
+			blocks_[0]->conservativeResize(2 * size);
+			blocks_[0]->tail(size).setZero();
+		}
+		else
+			blocks_.resize(2 * blocks_.size());
+
+		count_++;
+	}
+
+	void StateVector::reset()
+	{
+		//Set to |0...0> state, releasing every block but the first. The first is replaced
+		//rather than copied should a fork share it.
+		if (count_ == 0)
+			return;
+
+		std::fill(blocks_.begin() + 1, blocks_.end(), nullptr);
+
+		if (blocks_[0] && blocks_[0].use_count() == 1)
+			blocks_[0]->setZero();
+		else
+			blocks_[0] = std::make_shared<Ket>(Ket::Zero(block_size()));
+
+		(*blocks_[0])(0) = 1;
+	}
+
+	void StateVector::apply(const Mat &m, int q)
+	{
+		const Complex m00 = m(0, 0), m01 = m(0, 1), m10 = m(1, 0), m11 = m(1, 1);
+		const Eigen::Index mask = Eigen::Index(1) << q;
+		const Eigen::Index pairs = size() / 2;
+
+		//Each group of pairs lies within one block, or two should q select between blocks
+		const int bits = block_bits();
+		const Eigen::Index per_group = q < bits ? block_size() / 2 : block_size();
+
+		//X between blocks only exchanges them
+		const bool exchange = q >= bits && m00 == 0.0 && m01 == 1.0 && m10 == 1.0 && m11 == 0.0;
+
+		#pragma omp parallel for if(pairs >= PARALLEL_THRESHOLD)
+		for (Eigen::Index g = 0; g < pairs / per_group; g++)
+		{
+			const Eigen::Index first = g * per_group;
+			const Eigen::Index b0 = insert_zero(first, q) >> bits;
+			const Eigen::Index b1 = (insert_zero(first, q) | mask) >> bits;
+			const bool z0 = !blocks_[b0], z1 = !blocks_[b1];
+			if (z0 && z1)
+				continue;
+
+			if (exchange)
+			{
+				std::swap(blocks_[b0], blocks_[b1]);
+				continue;
+			}
+
+			if (b0 == b1)
+			{
+				apply_kernel(write(b0), block_size(), m, q);
+				continue;
+			}
+
+			//Otherwise the pairs lie at the same offset in each block. A block stays zero
+			//while every term feeding it is zero, as for diagonal gates, in which case it
+			//is neither written nor held.
+			const bool keep0 = !((z0 || m00 == 0.0) && (z1 || m01 == 0.0));
+			const bool keep1 = !((z0 || m10 == 0.0) && (z1 || m11 == 0.0));
+
+			Complex *w0 = keep0 ? write(b0) : nullptr;
+			Complex *w1 = keep1 ? write(b1) : nullptr;
+			const Complex *v0 = read(b0), *v1 = read(b1);
+
+			if (keep0 && keep1)
+			{
+				for (Eigen::Index j = 0; j < per_group; j++)
+				{
+					Complex a0 = v0[j], a1 = v1[j];
+					w0[j] = m00 * a0 + m01 * a1;
+					w1[j] = m10 * a0 + m11 * a1;
+				}
+			}
+			else if (keep0)
+			{
+				for (Eigen::Index j = 0; j < per_group; j++)
+					w0[j] = m00 * v0[j] + m01 * v1[j];
+				blocks_[b1] = nullptr;
+			}
+			else if (keep1)
+			{
+				for (Eigen::Index j = 0; j < per_group; j++)
+					w1[j] = m10 * v0[j] + m11 * v1[j];
+				blocks_[b0] = nullptr;
+			}
+			else
+			{
+				blocks_[b0] = nullptr;
+				blocks_[b1] = nullptr;
+			}
+		}
+	}
+
+	void StateVector::apply(const Mat &m, int a, int b)
+	{
+		const Eigen::Index mask_a = Eigen::Index(1) << a;
+		const Eigen::Index mask_b = Eigen::Index(1) << b;
+		const Eigen::Index quads = size() / 4;
+		const int lo = std::min(a, b), hi = std::max(a, b);
+
+		//Each group of quads lies within one, two or four blocks, depending on how many
+		//of a and b select between blocks
+		const int bits = block_bits();
+		const Eigen::Index low = block_size() - 1;
+		const int across = (a >= bits) + (b >= bits);
+		const Eigen::Index per_group = block_size() >> (2 - across);
+
+		#pragma omp parallel for if(quads >= PARALLEL_THRESHOLD)
+		for (Eigen::Index g = 0; g < quads / per_group; g++)
+		{
+			const Eigen::Index first = g * per_group;
+			const Eigen::Index start = insert_zero(insert_zero(first, lo), hi);
+			const Eigen::Index block[4] = { start >> bits, (start | mask_b) >> bits,
+				(start | mask_a) >> bits, (start | mask_a | mask_b) >> bits };
+
+			bool z[4], all = true;
+			for (int r = 0; r < 4; r++)
+				all &= z[r] = !blocks_[block[r]];
+			if (all)
+				continue;
+
+			if (across == 0)
+			{
+				apply_kernel(write(block[0]), block_size(), m, a, b);
+				continue;
+			}
+
+			//Each output is zero while every term feeding it is zero, and a block is only
+			//written and held while any of its outputs may be nonzero
+			bool nonzero[4] = {}, keep[4] = {};
+			for (int r = 0; r < 4; r++)
+				for (int c = 0; c < 4; c++)
+					nonzero[r] |= !z[c] && m(r, c) != 0.0;
+
+			for (int r = 0; r < 4; r++)
+				for (int s = 0; s < 4; s++)
+					keep[r] |= nonzero[s] && block[s] == block[r];
+
+			Complex *w[4];
+			const Complex *v[4];
+			for (int r = 0; r < 4; r++)
+				w[r] = keep[r] ? write(block[r]) : nullptr;
+			for (int r = 0; r < 4; r++)
+				v[r] = read(block[r]);
+
+			for (Eigen::Index k = first; k < first + per_group; k++)
+			{
+				//Operator basis index is (bit a, bit b)
+				Eigen::Index i[4];
+				i[0] = insert_zero(insert_zero(k, lo), hi);
+				i[1] = i[0] | mask_b;
+				i[2] = i[0] | mask_a;
+				i[3] = i[0] | mask_a | mask_b;
+
+				for (int r = 0; r < 4; r++)
+					i[r] &= low;
+
+				Complex in[4] = { v[0][i[0]], v[1][i[1]], v[2][i[2]], v[3][i[3]] };
+				for (int r = 0; r < 4; r++)
+					if (w[r])
+						w[r][i[r]] = m(r, 0) * in[0] + m(r, 1) * in[1] + m(r, 2) * in[2] + m(r, 3) * in[3];
+			}
+
+			for (int r = 0; r < 4; r++)
+				if (!keep[r])
+					blocks_[block[r]] = nullptr;
+		}
+	}
+
+	void StateVector::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//Unravel the channel: pick one Kraus operator with probability ||K|psi>||^2
+		const Eigen::Index mask = Eigen::Index(1) << q;
+		const Eigen::Index pairs = size() / 2;
+		const int bits = block_bits();
+		const Eigen::Index low = block_size() - 1;
+		const Eigen::Index per_group = q < bits ? block_size() / 2 : block_size();
+		double u = rng.uniform();
+
+		std::size_t chosen = 0;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			const Complex m00 = kraus[k](0, 0), m01 = kraus[k](0, 1), m10 = kraus[k](1, 0), m11 = kraus[k](1, 1);
+
+			//Groups are summed alone and added in order, so the choice is reproducible
+			std::vector<double> partial(static_cast<std::size_t>(pairs / per_group), 0.0);
+
+			#pragma omp parallel for if(pairs >= PARALLEL_THRESHOLD)
+			for (Eigen::Index g = 0; g < pairs / per_group; g++)
+			{
+				const Eigen::Index first = g * per_group;
+				const Eigen::Index b0 = insert_zero(first, q) >> bits;
+				const Eigen::Index b1 = (insert_zero(first, q) | mask) >> bits;
+				if (!blocks_[b0] && !blocks_[b1])
+					continue;
+
+				const Complex *v0 = read(b0), *v1 = read(b1);
+				for (Eigen::Index j = first; j < first + per_group; j++)
+				{
+					Eigen::Index i0 = insert_zero(j, q);
+					Complex a0 = v0[i0 & low], a1 = v1[(i0 | mask) & low];
+					partial[g] += std::norm(m00 * a0 + m01 * a1) + std::norm(m10 * a0 + m11 * a1);
+				}
+			}
+
+			double pk = 0;
+			for (double part : partial)
+				pk += part;
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = k;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		apply(kraus[chosen] / std::sqrt(p), q);
+	}
+
+	double StateVector::probability(int q) const
+	{
+		const Eigen::Index mask = Eigen::Index(1) << q;
+		const Eigen::Index size = block_size();
+
+		//Each block is summed alone and the totals added in block order, so a measurement
+		//draws against the same probability however many threads run
+		std::vector<double> partial(static_cast<std::size_t>(blocks()), 0.0);
+
+		#pragma omp parallel for if(this->size() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index b = 0; b < blocks(); b++)
+		{
+			if (!blocks_[b])
+				continue;
+
+			const Complex *v = read(b);
+			for (Eigen::Index j = 0; j < size; j++)
+				if ((b * size + j) & mask)
+					partial[b] += std::norm(v[j]);
+		}
+
+		double p = 0;
+		for (double part : partial)
+			p += part;
+
+		return p;
+	}
+
+	double StateVector::probability(Bitstring outcome) const
+	{
+		if (!within_qubits(outcome, count_))
+			throw std::out_of_range("Outcome has bits beyond the qubits of the state");
+
+		return std::norm(amplitude(static_cast<Eigen::Index>(outcome)));
+	}
+
+	std::vector<double> StateVector::marginal(const std::vector<int> &indices) const
+	{
+		const Eigen::Index total = size();
+		const int bits = block_bits();
+		const Eigen::Index size = block_size();
+		const Eigen::Index slices = std::min(MARGINAL_SLICES, blocks());
+		std::vector<double> p(std::size_t(1) << indices.size(), 0.0);
+
+		//Many outcomes, or every qubit in order, are left to marginalise, blocks not held
+		//reading as zeros
+		if (static_cast<Eigen::Index>(p.size()) * slices > total || slices == 0)
+			return marginalise(total, indices, [&](Eigen::Index i) { return std::norm(read(i >> bits)[i & (size - 1)]); });
+
+		//Fixed slices of the held blocks each fill a private histogram, merged in slice
+		//order, so the sums are independent of the number of threads
+		const Eigen::Index length = blocks() / slices;
+		std::vector<std::vector<double>> partial(static_cast<std::size_t>(slices));
+
+		#pragma omp parallel for if(total >= PARALLEL_THRESHOLD)
+		for (Eigen::Index s = 0; s < slices; s++)
+		{
+			std::vector<double> &local = partial[s];
+			local.assign(p.size(), 0.0);
+
+			for (Eigen::Index b = s * length; b < (s + 1) * length; b++)
+			{
+				if (!blocks_[b])
+					continue;
+
+				const Complex *v = read(b);
+				for (Eigen::Index j = 0; j < size; j++)
+					local[gather_bits(b * size + j, indices)] += std::norm(v[j]);
+			}
+		}
+
+		for (const std::vector<double> &local : partial)
+			for (std::size_t j = 0; j < p.size(); j++)
+				p[j] += local[j];
+
+		return p;
+	}
+
+	void StateVector::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		const int bits = block_bits();
+		const Eigen::Index size = block_size();
+
+		//Outcome bits of the qubits selecting blocks, which decide whole blocks at once
+		Bitstring high_mask = 0;
+		for (std::size_t j = 0; j < indices.size(); j++)
+			if (indices[j] >= bits)
+				high_mask |= Bitstring(1) << j;
+
+		//Release contradictory blocks unread, and zero contradictory amplitudes and
+		//renormalise the rest of the others in one pass
+		const double scale = 1.0 / std::sqrt(p);
+
+		#pragma omp parallel for if(this->size() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index b = 0; b < blocks(); b++)
+		{
+			if (!blocks_[b])
+				continue;
+
+			if ((gather_bits(b * size, indices) ^ outcome) & high_mask)
+			{
+				blocks_[b] = nullptr;
+				continue;
+			}
+
+			Complex *v = write(b);
+			bool nonzero = false;
+			for (Eigen::Index j = 0; j < size; j++)
+			{
+				v[j] = gather_bits(b * size + j, indices) == outcome ? v[j] * scale : Complex(0);
+				nonzero |= v[j] != Complex(0);
+			}
+
+			if (!nonzero)
+				blocks_[b] = nullptr;
+		}
+	}
+
+	double StateVector::expectation(const PauliString &p) const
+	{
+		if (!within_qubits(p.x_mask() | p.z_mask(), count_))
+			throw std::out_of_range("Pauli string acts on qubits beyond those of the state");
+
+		const Eigen::Index x = static_cast<Eigen::Index>(p.x_mask());
+		const Bitstring z = p.z_mask();
+		const Eigen::Index size = block_size();
+		const Eigen::Index x_low = x & (size - 1);
+
+		//P|j> = i^(#Y) (-1)^(popcount(j & z)) |j ^ x>, which is zero should either block be.
+		//Blocks are summed alone and added in order, as for probability(int).
+		std::vector<Complex> partial(static_cast<std::size_t>(blocks()), Complex(0));
+
+		#pragma omp parallel for if(this->size() >= PARALLEL_THRESHOLD)
+		for (Eigen::Index b = 0; b < blocks(); b++)
+		{
+			const Eigen::Index c = b ^ (x >> block_bits());
+			if (!blocks_[b] || !blocks_[c])
+				continue;
+
+			const Complex *v = read(b), *w = read(c);
+			for (Eigen::Index j = 0; j < size; j++)
+			{
+				Complex term = std::conj(w[j ^ x_low]) * v[j];
+				partial[b] += parity((b * size + j) & z) ? -term : term;
+			}
+		}
+
+		Complex sum = 0;
+		for (Complex part : partial)
+			sum += part;
+
+		//The result is real for a Hermitian P
+		return (pauli_phase(p) * sum).real();
+	}
+
+	void StateVector::print(std::ostream &os, int count) const
+	{
+		//Print each coefficient, without reading blocks known to be zero
+		for (Eigen::Index i = 0; i < size(); i++)
+		{
+			//Format basis vector as binary number
+			os << "|";
+			for (int j = count; j > 0; j--)
+				os << ((i >> (j-1)) & 1);
+			os << "> ";
+
+			print_complex(os, amplitude(i));
+			os << std::endl;
+		}
+	}
+
+	BackendReport StateVector::report() const
+	{
+		//Only the blocks held take memory, and gates only touch those
+		double held = static_cast<double>((blocks() - std::count(blocks_.begin(), blocks_.end(), nullptr)) * block_size());
+		return { Backend::StateVector, held * sizeof(Complex), held, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> StateVector::fork() const
+	{
+		return std::make_unique<StateVector>(*this);
+	}
+
+	void StateVector::save(std::ostream &os) const
+	{
+		for (Eigen::Index b = 0; b < blocks(); b++)
+			os.write(reinterpret_cast<const char *>(read(b)), block_size() * sizeof(Complex));
+	}
+
+	void StateVector::load(const Complex *v, int count, const std::vector<int> &layout)
+	{
+		const Eigen::Index size = count ? Eigen::Index(1) << count : 0;
+		Ket k(size);
+
+		bool identity = true;
+		for (int q = 0; q < count; q++)
+			identity &= layout[q] == q;
+
+		//Copy straight from the source unless the qubits must be rearranged
+		if (identity)
+			std::copy(v, v + size, k.data());
+		else
+		{
+			#pragma omp parallel for if(size >= PARALLEL_THRESHOLD)
+			for (Eigen::Index i = 0; i < size; i++)
+				k(i) = v[scatter_bits(static_cast<Bitstring>(i), layout)];
+		}
+
+		*this = StateVector(std::move(k), count);
+	}
+}
@@ -0,0 +1,92 @@
+/**
+ * @file StateVector.h
+ *
+ * Internal header defining the dense state vector backend
+ * and the amplitude kernels shared with other backends.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+namespace qlay
+{
+	//State vectors are held in blocks of 2^ZERO_BLOCK_BITS amplitudes, any known to be all zero omitted
+	constexpr int ZERO_BLOCK_BITS = 12;
+
+	//Returns k with a zero bit inserted at the given position
+	inline Eigen::Index insert_zero(Eigen::Index k, int bit)
+	{
+		Eigen::Index low = k & ((Eigen::Index(1) << bit) - 1);
+		return ((k >> bit) << (bit + 1)) | low;
+	}
+
+	//Applies the 2x2 operator m in place to bit q of the given amplitude array
+	void apply_kernel(Complex *v, Eigen::Index size, const Mat &m, int q);
+
+	//Applies the 4x4 operator m in place to bits a (high-order input) and b of the given amplitude array
+	void apply_kernel(Complex *v, Eigen::Index size, const Mat &m, int a, int b);
+
+	//Dense state vector of 2^n complex amplitudes, held in blocks. Blocks known to be
+	//all zero, such as those contradicting a measurement, are not held at all, so gates
+	//and queries skip them; a held block may still happen to be zero. Forks share the
+	//blocks, each copied only once either system modifies it, so blocks left zero,
+	//discarded by a measurement or exchanged by an X gate are never copied.
+	class StateVector : public State
+	{
+	private:
+		std::vector<std::shared_ptr<Ket>> blocks_; //Null for blocks known to be all zero
+		int count_ = 0;
+
+		//Number of bits indexing amplitudes within a block
+		int block_bits() const { return std::min(count_, ZERO_BLOCK_BITS); }
+		Eigen::Index block_size() const { return Eigen::Index(1) << block_bits(); }
+		Eigen::Index blocks() const { return static_cast<Eigen::Index>(blocks_.size()); }
+
+		//Returns the amplitudes of block b, reading zeros should it not be held
+		const Complex *read(Eigen::Index b) const;
+
+		//Returns the amplitudes of block b for modification, first allocating it should
+		//it not be held, or copying it should a fork share it
+		Complex *write(Eigen::Index b);
+
+	public:
+		StateVector() = default;
+
+		//Adopts the given amplitudes of a count-qubit state
+		StateVector(Ket v, int count);
+
+		//Returns the amplitudes gathered into an Eigen state vector
+		Ket get() const;
+
+		//Returns the number of amplitudes
+		Eigen::Index size() const { return blocks() << block_bits(); }
+
+		//Returns the amplitude of the given basis state
+		Complex amplitude(Eigen::Index i) const { return read(i >> block_bits())[i & (block_size() - 1)]; }
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		Bitstring measure(const std::vector<int> &indices) override { return measure_marginal(indices); }
+		std::vector<Bitstring> sample(unsigned shots, const std::vector<int> &indices) const override { return sample_marginal(shots, indices); }
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+
+		void save(std::ostream &os) const override;
+		void load(const Complex *v, int count, const std::vector<int> &layout) override;
+	};
+}
@@ -0,0 +1,566 @@
+/**
+ * @file TensorNetwork.cpp
+ *
+ * Implements the tensor network contraction engine and backend.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "TensorNetwork.h"
+#include "StateVector.h"
+
+#include <cmath>
+#include <limits>
+
+namespace qlay
+{
+	namespace
+	{
+		//Largest intermediate tensor allowed before slicing, as a power of two elements
+		constexpr int MAX_RANK = 24;
+
+		//Most labels sliced, bounding the number of independent contractions
+		constexpr int MAX_SLICED = 16;
+
+		//Number of contraction orders tried, the first purely greedy
+		constexpr int ORDER_TRIALS = 16;
+
+		//Scale of the noise added to greedy choices in randomised trials
+		constexpr double TEMPERATURE = 1.0;
+
+		using RowMat = Eigen::Matrix<Complex, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+		//Order of pairwise contractions: each step contracts two tensors, numbering
+		//the result after the original tensors and the results of earlier steps
+		struct Path
+		{
+			std::vector<std::pair<int, int>> steps;
+			std::vector<std::vector<int>> intermediates;
+			double flops = 0;
+			int max_rank = 0;
+		};
+
+		bool contains(const std::vector<int> &labels, int l)
+		{
+			return std::find(labels.begin(), labels.end(), l) != labels.end();
+		}
+
+		//Returns the labels left open by contracting a with b: a's unshared labels then b's
+		std::vector<int> merged(const std::vector<int> &a, const std::vector<int> &b)
+		{
+			std::vector<int> result;
+			for (int l : a)
+				if (!contains(b, l))
+					result.push_back(l);
+			for (int l : b)
+				if (!contains(a, l))
+					result.push_back(l);
+
+			return result;
+		}
+
+		//Chooses a contraction order greedily, favouring contractions which shrink the
+		//network most. Given a generator, perturbs each choice to explore other orders.
+		Path find_path(std::vector<std::vector<int>> labels, Philox *noise)
+		{
+			Path path;
+			std::vector<bool> active(labels.size(), true);
+
+			//Tensors holding each label
+			std::map<int, std::vector<int>> holders;
+			for (std::size_t i = 0; i < labels.size(); i++)
+				for (int l : labels[i])
+					holders[l].push_back(static_cast<int>(i));
+
+			for (std::size_t remaining = labels.size(); remaining > 1; remaining--)
+			{
+				int best_i = -1, best_j = -1;
+				double best = std::numeric_limits<double>::infinity();
+
+				for (const auto &h : holders)
+				{
+					if (h.second.size() != 2)
+						continue;
+
+					int i = h.second[0], j = h.second[1];
+					double ri = static_cast<double>(labels[i].size());
+					double rj = static_cast<double>(labels[j].size());
+					double score = merged(labels[i], labels[j]).size() - (ri + rj) / 2;
+
+					if (noise)
+						score -= TEMPERATURE * std::log(-std::log(noise->uniform() + 1e-300));
+
+					if (score < best)
+					{
+						best = score;
+						best_i = i;
+						best_j = j;
+					}
+				}
+
+				//Disconnected parts are joined by an outer product of the two smallest tensors
+				if (best_i < 0)
+				{
+					for (std::size_t k = 0; k < labels.size(); k++)
+					{
+						if (!active[k])
+							continue;
+
+						int t = static_cast<int>(k);
+						if (best_i < 0 || labels[t].size() < labels[best_i].size())
+						{
+							best_j = best_i;
+							best_i = t;
+						}
+						else if (best_j < 0 || labels[t].size() < labels[best_j].size())
+							best_j = t;
+					}
+				}
+
+				std::vector<int> result = merged(labels[best_i], labels[best_j]);
+				int id = static_cast<int>(labels.size());
+
+				std::size_t shared = (labels[best_i].size() + labels[best_j].size() - result.size()) / 2;
+				path.flops += std::ldexp(1.0, static_cast<int>(result.size() + shared));
+				path.max_rank = std::max(path.max_rank, static_cast<int>(result.size()));
+				path.steps.emplace_back(best_i, best_j);
+				path.intermediates.push_back(result);
+
+				for (int t : { best_i, best_j })
+				{
+					for (int l : labels[t])
+					{
+						std::vector<int> &h = holders[l];
+						h.erase(std::find(h.begin(), h.end(), t));
+					}
+					active[t] = false;
+				}
+
+				for (int l : result)
+					holders[l].push_back(id);
+
+				labels.push_back(std::move(result));
+				active.push_back(true);
+			}
+
+			return path;
+		}
+
+		//Returns the best of several greedy contraction orders
+		Path best_path(const std::vector<std::vector<int>> &labels)
+		{
+			Path best = find_path(labels, nullptr);
+
+			//A fixed seed keeps the order, and so the rounding of results, reproducible
+			for (int trial = 1; trial < ORDER_TRIALS; trial++)
+			{
+				Philox noise(0x5eed, static_cast<std::uint64_t>(trial));
+				Path path = find_path(labels, &noise);
+
+				if (path.max_rank < best.max_rank || (path.max_rank == best.max_rank && path.flops < best.flops))
+					best = std::move(path);
+			}
+
+			return best;
+		}
+
+		//Returns the tensor with the given label fixed to the given value, removing it
+		Tensor fix_label(const Tensor &t, int label, int value)
+		{
+			int rank = static_cast<int>(t.labels.size());
+			int pos = static_cast<int>(std::find(t.labels.begin(), t.labels.end(), label) - t.labels.begin());
+			int bit = rank - 1 - pos;
+
+			Tensor result;
+			result.labels = t.labels;
+			result.labels.erase(result.labels.begin() + pos);
+			result.data.resize(t.data.size() / 2);
+
+			for (std::size_t i = 0; i < result.data.size(); i++)
+				result.data[i] = t.data[insert_zero(static_cast<Eigen::Index>(i), bit) | (Eigen::Index(value) << bit)];
+
+			return result;
+		}
+
+		//Contracts a with b over their shared labels as a single matrix product
+		Tensor contract(const Tensor &a, const Tensor &b)
+		{
+			std::vector<int> shared, free_a, free_b;
+			for (int l : a.labels)
+				(contains(b.labels, l) ? shared : free_a).push_back(l);
+			for (int l : b.labels)
+				if (!contains(a.labels, l))
+					free_b.push_back(l);
+
+			std::vector<int> order_a = free_a, order_b = shared;
+			order_a.insert(order_a.end(), shared.begin(), shared.end());
+			order_b.insert(order_b.end(), free_b.begin(), free_b.end());
+
+			const Tensor pa = order_a == a.labels ? a : permute(a, order_a);
+			const Tensor pb = order_b == b.labels ? b : permute(b, order_b);
+
+			Eigen::Index rows = Eigen::Index(1) << free_a.size();
+			Eigen::Index inner = Eigen::Index(1) << shared.size();
+			Eigen::Index cols = Eigen::Index(1) << free_b.size();
+
+			Tensor result;
+			result.labels = free_a;
+			result.labels.insert(result.labels.end(), free_b.begin(), free_b.end());
+			result.data.resize(static_cast<std::size_t>(rows * cols));
+
+			Eigen::Map<const RowMat> ma(pa.data.data(), rows, inner);
+			Eigen::Map<const RowMat> mb(pb.data.data(), inner, cols);
+			Eigen::Map<RowMat> mc(result.data.data(), rows, cols);
+			mc.noalias() = ma * mb;
+
+			return result;
+		}
+
+		//Contracts the network along the given path
+		Tensor execute(std::vector<Tensor> pool, const Path &path)
+		{
+			pool.reserve(pool.size() + path.steps.size());
+
+			for (const auto &step : path.steps)
+			{
+				pool.push_back(contract(pool[step.first], pool[step.second]));
+
+				//Release the inputs, which are never used again
+				pool[step.first] = Tensor();
+				pool[step.second] = Tensor();
+			}
+
+			return std::move(pool.back());
+		}
+	}
+
+	Tensor permute(const Tensor &t, const std::vector<int> &labels)
+	{
+		const int rank = static_cast<int>(labels.size());
+
+		//Bit of the source index taken by each bit of the result index
+		std::vector<int> source(rank);
+		for (int k = 0; k < rank; k++)
+		{
+			int pos = static_cast<int>(std::find(t.labels.begin(), t.labels.end(), labels[k]) - t.labels.begin());
+			source[k] = rank - 1 - pos;
+		}
+
+		Tensor result;
+		result.labels = labels;
+		result.data.resize(t.data.size());
+
+		for (std::size_t o = 0; o < result.data.size(); o++)
+		{
+			std::size_t i = 0;
+			for (int k = 0; k < rank; k++)
+				i |= ((o >> (rank - 1 - k)) & 1) << source[k];
+
+			result.data[o] = t.data[i];
+		}
+
+		return result;
+	}
+
+	Tensor contract_network(const std::vector<Tensor> &network)
+	{
+		if (network.empty())
+			return { {}, { 1 } };
+
+		std::vector<std::vector<int>> labels(network.size());
+		std::map<int, int> occurrences;
+		for (std::size_t i = 0; i < network.size(); i++)
+		{
+			labels[i] = network[i].labels;
+			for (int l : labels[i])
+				occurrences[l]++;
+		}
+
+		//Slice the label most common among the largest intermediates until they fit
+		std::vector<int> sliced;
+		Path path = best_path(labels);
+
+		while (path.max_rank > MAX_RANK && static_cast<int>(sliced.size()) < MAX_SLICED)
+		{
+			std::map<int, int> frequency;
+			for (const auto &intermediate : path.intermediates)
+				if (static_cast<int>(intermediate.size()) >= path.max_rank - 1)
+					for (int l : intermediate)
+						if (occurrences[l] == 2)
+							frequency[l]++;
+
+			if (frequency.empty())
+				break;
+
+			int label = std::max_element(frequency.begin(), frequency.end(),
+				[](const std::pair<const int, int> &a, const std::pair<const int, int> &b) { return a.second < b.second; })->first;
+
+			sliced.push_back(label);
+			for (auto &l : labels)
+				l.erase(std::remove(l.begin(), l.end(), label), l.end());
+
+			path = best_path(labels);
+		}
+
+		//Contract each slice independently, then sum them in a fixed order
+		const long long slices = 1LL << sliced.size();
+		std::vector<Tensor> results(static_cast<std::size_t>(slices));
+
+		#pragma omp parallel for schedule(dynamic) if(slices > 1)
+		for (long long s = 0; s < slices; s++)
+		{
+			std::vector<Tensor> pool = network;
+			for (std::size_t k = 0; k < sliced.size(); k++)
+			{
+				int value = static_cast<int>((s >> k) & 1);
+				for (Tensor &t : pool)
+					if (contains(t.labels, sliced[k]))
+						t = fix_label(t, sliced[k], value);
+			}
+
+			results[s] = execute(std::move(pool), path);
+		}
+
+		Tensor total = std::move(results[0]);
+		for (long long s = 1; s < slices; s++)
+			for (std::size_t i = 0; i < total.data.size(); i++)
+				total.data[i] += results[s].data[i];
+
+		return total;
+	}
+
+	void TensorNetwork::add_qubit()
+	{
+		count_++;
+	}
+
+	void TensorNetwork::reset()
+	{
+		ops_.clear();
+	}
+
+	void TensorNetwork::record(std::vector<int> qubits, const Mat &m)
+	{
+		bool unitary = (m.adjoint() * m).isIdentity(1e-10);
+		ops_.push_back({ std::move(qubits), m, unitary });
+	}
+
+	void TensorNetwork::apply(const Mat &m, int q)
+	{
+		record({ q }, m);
+	}
+
+	void TensorNetwork::apply(const Mat &m, int a, int b)
+	{
+		record({ a, b }, m);
+	}
+
+	void TensorNetwork::apply_channel(const std::vector<Mat> &kraus, int q)
+	{
+		//Unravel the channel: pick one Kraus operator with probability <psi|K^dagger K|psi>
+		double u = rng.uniform();
+
+		std::size_t chosen = 0;
+		double p = 0, acc = 0;
+		for (std::size_t k = 0; k < kraus.size(); k++)
+		{
+			double pk = expect({ { q, kraus[k].adjoint() * kraus[k] } }).real();
+
+			//Fall back on the last possible operator should rounding leave u unmatched
+			if (pk > 0)
+			{
+				chosen = k;
+				p = pk;
+			}
+
+			acc += pk;
+			if (u < acc && pk > 0)
+				break;
+		}
+
+		record({ q }, kraus[chosen] / std::sqrt(p));
+	}
+
+	std::vector<int> TensorNetwork::add_circuit(std::vector<Tensor> &network, const std::vector<bool> &keep,
+		const std::vector<bool> &wires, bool conjugate, int &next_label) const
+	{
+		std::vector<int> current(count_, -1);
+		for (int q = 0; q < count_; q++)
+			if (wires[q])
+			{
+				current[q] = next_label++;
+				network.push_back({ { current[q] }, { 1, 0 } });
+			}
+
+		for (std::size_t i = 0; i < ops_.size(); i++)
+		{
+			if (!keep[i])
+				continue;
+
+			//Labels run over the outputs then the inputs, matching the row-major operator
+			const Operation &op = ops_[i];
+			Tensor t;
+			for (std::size_t k = 0; k < op.qubits.size(); k++)
+				t.labels.push_back(next_label++);
+			for (int q : op.qubits)
+				t.labels.push_back(current[q]);
+
+			t.data.reserve(op.m.size());
+			for (Eigen::Index r = 0; r < op.m.rows(); r++)
+				for (Eigen::Index c = 0; c < op.m.cols(); c++)
+					t.data.push_back(conjugate ? std::conj(op.m(r, c)) : op.m(r, c));
+
+			for (std::size_t k = 0; k < op.qubits.size(); k++)
+				current[op.qubits[k]] = t.labels[k];
+
+			network.push_back(std::move(t));
+		}
+
+		return current;
+	}
+
+	Complex TensorNetwork::expect(const std::map<int, Mat> &ops) const
+	{
+		//Walk back through the circuit keeping only the gates which can affect the
+		//observed qubits; each unitary outside this light cone cancels its conjugate
+		std::vector<bool> cone(count_, false);
+		for (const auto &op : ops)
+			cone[op.first] = true;
+
+		std::vector<bool> keep(ops_.size(), false);
+		for (std::size_t i = ops_.size(); i-- > 0; )
+		{
+			const Operation &op = ops_[i];
+
+			bool touches = false;
+			for (int q : op.qubits)
+				touches = touches || cone[q];
+
+			//Projections and Kraus operators never cancel
+			if (touches || !op.unitary)
+			{
+				keep[i] = true;
+				for (int q : op.qubits)
+					cone[q] = true;
+			}
+		}
+
+		//Join the circuit to its conjugate through the observed operators
+		std::vector<Tensor> network;
+		int next_label = 0;
+		std::vector<int> ket = add_circuit(network, keep, cone, false, next_label);
+		std::vector<int> bra = add_circuit(network, keep, cone, true, next_label);
+
+		for (int q = 0; q < count_; q++)
+		{
+			if (!cone[q])
+				continue;
+
+			auto it = ops.find(q);
+			Mat o = it != ops.end() ? it->second : Mat::Identity(2, 2);
+			network.push_back({ { bra[q], ket[q] }, { o(0, 0), o(0, 1), o(1, 0), o(1, 1) } });
+		}
+
+		return contract_network(network).data[0];
+	}
+
+	double TensorNetwork::probability(int q) const
+	{
+		return expect({ { q, (Mat(2, 2) << 0, 0, 0, 1).finished() } }).real();
+	}
+
+	double TensorNetwork::probability(Bitstring outcome) const
+	{
+		//Close each output with the chosen basis state to give a single amplitude
+		std::vector<Tensor> network;
+		int next_label = 0;
+		std::vector<int> ket = add_circuit(network, std::vector<bool>(ops_.size(), true),
+			std::vector<bool>(count_, true), false, next_label);
+
+		for (int q = 0; q < count_; q++)
+		{
+			bool one = q < 64 && ((outcome >> q) & 1);
+			network.push_back({ { ket[q] }, { one ? 0.0 : 1.0, one ? 1.0 : 0.0 } });
+		}
+
+		return std::norm(contract_network(network).data[0]);
+	}
+
+	std::vector<double> TensorNetwork::marginal(const std::vector<int> &indices) const
+	{
+		static const Mat PROJECT[] = {
+			(Mat(2, 2) << 1, 0, 0, 0).finished(),
+			(Mat(2, 2) << 0, 0, 0, 1).finished()
+		};
+
+		//One contraction per outcome, so suited to few indices
+		std::vector<double> prob(Bitstring(1) << indices.size());
+		for (Bitstring o = 0; o < prob.size(); o++)
+		{
+			std::map<int, Mat> ops;
+			for (std::size_t j = 0; j < indices.size(); j++)
+				ops[indices[j]] = PROJECT[(o >> j) & 1];
+
+			prob[o] = std::max(0.0, expect(ops).real());
+		}
+
+		return prob;
+	}
+
+	void TensorNetwork::collapse(const std::vector<int> &indices, Bitstring outcome, double p)
+	{
+		//Record a projection of each qubit, the first also renormalising
+		for (std::size_t j = 0; j < indices.size(); j++)
+		{
+			Mat projector = Mat::Zero(2, 2);
+			projector((outcome >> j) & 1, (outcome >> j) & 1) = j == 0 ? 1 / std::sqrt(p) : 1;
+			record({ indices[j] }, projector);
+		}
+	}
+
+	double TensorNetwork::expectation(const PauliString &p) const
+	{
+		static const Mat *paulis[] = { nullptr, &PAULI_X, &PAULI_Z, &PAULI_Y };
+
+		std::map<int, Mat> ops;
+		for (int q = 0; q < count_ && q < 64; q++)
+		{
+			const Mat *op = paulis[((p.x_mask() >> q) & 1) | (((p.z_mask() >> q) & 1) << 1)];
+			if (op)
+				ops[q] = *op;
+		}
+
+		return expect(ops).real();
+	}
+
+	void TensorNetwork::print(std::ostream &os, int count) const
+	{
+		//Contract the whole circuit, leaving every output open
+		std::vector<Tensor> network;
+		int next_label = 0;
+		std::vector<int> ket = add_circuit(network, std::vector<bool>(ops_.size(), true),
+			std::vector<bool>(count_, true), false, next_label);
+
+		//Order the outputs so that the highest qubit is the most significant bit
+		std::vector<int> outputs(ket.rbegin(), ket.rend());
+		Tensor t = permute(contract_network(network), outputs);
+
+		Ket v = Eigen::Map<const Ket>(t.data.data(), static_cast<Eigen::Index>(t.data.size()));
+		StateVector(std::move(v), count).print(os, count);
+	}
+
+	BackendReport TensorNetwork::report() const
+	{
+		double memory = 0;
+		for (const Operation &op : ops_)
+			memory += op.m.size() * sizeof(Complex) + op.qubits.size() * sizeof(int);
+
+		//Gates are only recorded, the work being deferred to each query
+		return { Backend::TensorNetwork, memory, 1, "Chosen explicitly" };
+	}
+
+	std::unique_ptr<State> TensorNetwork::fork() const
+	{
+		return std::make_unique<TensorNetwork>(*this);
+	}
+}
@@ -0,0 +1,86 @@
+/**
+ * @file TensorNetwork.h
+ *
+ * Internal header defining the tensor network backend
+ * and the contraction engine it is built upon.
+ *
+ * @author Sam Griffiths
+ */
+
+#pragma once
+
+#include "Core.h"
+
+#include <map>
+
+namespace qlay
+{
+	//Tensor whose indices each have dimension 2 and are identified by integer
+	//labels, with its elements stored in row-major order of the labels
+	struct Tensor
+	{
+		std::vector<int> labels;
+		std::vector<Complex> data;
+	};
+
+	//Contracts a network of tensors over every label shared by two of them. Labels
+	//held by a single tensor remain open in the result, in unspecified order. The
+	//order of pairwise contractions is chosen greedily with randomised refinement,
+	//and closed labels are sliced, summing over their values in parallel, should an
+	//intermediate tensor otherwise exceed the memory limit.
+	Tensor contract_network(const std::vector<Tensor> &network);
+
+	//Returns the tensor with its labels reordered as given
+	Tensor permute(const Tensor &t, const std::vector<int> &labels);
+
+	//Records the gates applied, contracting them into a tensor network only when
+	//a probability or expectation is queried. Each query keeps only the gates in
+	//the backward light cone of the qubits it involves, so local queries on wide,
+	//shallow circuits never build the full state vector.
+	class TensorNetwork : public State
+	{
+	private:
+		//Operator applied to the given qubits, with the first as the high-order input
+		struct Operation
+		{
+			std::vector<int> qubits;
+			Mat m;
+			bool unitary;
+		};
+
+		std::vector<Operation> ops_;
+		int count_ = 0;
+
+		//Appends the tensors of the kept operations applied to |0>, or of their
+		//conjugate, to the network. Qubits not on any wire are left out. Returns the
+		//output label of each qubit.
+		std::vector<int> add_circuit(std::vector<Tensor> &network, const std::vector<bool> &keep,
+			const std::vector<bool> &wires, bool conjugate, int &next_label) const;
+
+		//Records an operation, noting whether it is unitary
+		void record(std::vector<int> qubits, const Mat &m);
+
+		//Returns <psi|O|psi> for O the product of the given single-qubit operators
+		Complex expect(const std::map<int, Mat> &ops) const;
+
+	public:
+		TensorNetwork() = default;
+
+		void add_qubit() override;
+		void reset() override;
+
+		void apply(const Mat &m, int q) override;
+		void apply(const Mat &m, int a, int b) override;
+		void apply_channel(const std::vector<Mat> &kraus, int q) override;
+
+		double probability(int q) const override;
+		double probability(Bitstring outcome) const override;
+		std::vector<double> marginal(const std::vector<int> &indices) const override;
+		void collapse(const std::vector<int> &indices, Bitstring outcome, double p) override;
+		double expectation(const PauliString &p) const override;
+
+		void print(std::ostream &os, int count) const override;
+		BackendReport report() const override;
+		std::unique_ptr<State> fork() const override;
+	};
+}
@@ -9,6 +9,8 @@
 
 #include "../Qlay/Qlay.h"
 
+#include <msclr/marshal_cppstd.h>
+
 namespace qlay
 {
 	namespace cli
@@ -38,17 +40,43 @@ namespace qlay
 		};
 
 
+		//Simulation backends which may hold a QubitSystem's state
+		public enum class Backend
+		{
+			StateVector = static_cast<int>(qlay::Backend::StateVector),
+			DensityMatrix = static_cast<int>(qlay::Backend::DensityMatrix),
+			Stabilizer = static_cast<int>(qlay::Backend::Stabilizer),
+			MatrixProduct = static_cast<int>(qlay::Backend::MatrixProduct),
+			Sparse = static_cast<int>(qlay::Backend::Sparse),
+			Factored = static_cast<int>(qlay::Backend::Factored),
+			DecisionDiagram = static_cast<int>(qlay::Backend::DecisionDiagram),
+			TensorNetwork = static_cast<int>(qlay::Backend::TensorNetwork),
+			Hybrid = static_cast<int>(qlay::Backend::Hybrid),
+			OutOfCore = static_cast<int>(qlay::Backend::OutOfCore),
+			Compressed = static_cast<int>(qlay::Backend::Compressed),
+			Automatic = static_cast<int>(qlay::Backend::Automatic)
+		};
+
 		//Represents a system of potentially entangled qubits
 		public ref class QubitSystem
 		{
 		internal:
 			qlay::QubitSystem *impl_;
 
+			//Adopts the given native system
+			QubitSystem(qlay::QubitSystem &&system) : impl_(new qlay::QubitSystem(std::move(system)))
+			{
+			}
+
 		public:
 			QubitSystem() : impl_(new qlay::QubitSystem())
 			{
 			}
 
+			QubitSystem(Backend backend) : impl_(new qlay::QubitSystem(static_cast<qlay::Backend>(backend)))
+			{
+			}
+
 			~QubitSystem()
 			{
 				this->!QubitSystem();
@@ -64,7 +92,106 @@ namespace qlay
 			}
 
 			int count() { return impl_->count(); }
+			Backend backend() { return static_cast<Backend>(impl_->backend()); }
+
+			//Describes the backend currently holding the state and why it was chosen
+			System::String ^report()
+			{
+				qlay::BackendReport r = impl_->report();
+				return gcnew System::String(r.reason.c_str());
+			}
+
+			void set_noise(double depolarizing, double amplitude_damping, double phase_damping)
+			{
+				qlay::NoiseModel noise;
+				noise.depolarizing = depolarizing;
+				noise.amplitude_damping = amplitude_damping;
+				noise.phase_damping = phase_damping;
+				impl_->set_noise(noise);
+			}
+
+			void set_truncation(int max_bond, double max_error)
+			{
+				qlay::Truncation truncation;
+				truncation.max_bond = max_bond;
+				truncation.max_error = max_error;
+				impl_->set_truncation(truncation);
+			}
+
+			void set_truncation(int max_bond, double max_error, double compression_error)
+			{
+				qlay::Truncation truncation;
+				truncation.max_bond = max_bond;
+				truncation.max_error = max_error;
+				truncation.compression_error = compression_error;
+				impl_->set_truncation(truncation);
+			}
+
 			void reset() { impl_->reset(); }
+
+			array<unsigned long long> ^sample(unsigned shots)
+			{
+				return to_array(impl_->sample(shots));
+			}
+
+			array<unsigned long long> ^sample(unsigned shots, array<int> ^indices)
+			{
+				std::vector<int> v(indices->Length);
+				for (int i = 0; i < indices->Length; i++)
+					v[i] = indices[i];
+
+				return to_array(impl_->sample(shots, v));
+			}
+
+			double probability(unsigned long long outcome)
+			{
+				return impl_->probability(outcome);
+			}
+
+			array<double> ^marginal(array<int> ^indices)
+			{
+				std::vector<int> v(indices->Length);
+				for (int i = 0; i < indices->Length; i++)
+					v[i] = indices[i];
+
+				std::vector<double> p = impl_->marginal(v);
+				array<double> ^a = gcnew array<double>(static_cast<int>(p.size()));
+				for (int i = 0; i < a->Length; i++)
+					a[i] = p[i];
+
+				return a;
+			}
+
+			double expectation(System::String ^paulis)
+			{
+				return impl_->expectation(qlay::PauliString(msclr::interop::marshal_as<std::string>(paulis)));
+			}
+
+			QubitSystem ^fork()
+			{
+				return gcnew QubitSystem(impl_->fork());
+			}
+
+			void save(System::String ^path)
+			{
+				impl_->save(msclr::interop::marshal_as<std::string>(path));
+			}
+
+			void load(System::String ^path)
+			{
+				impl_->load(msclr::interop::marshal_as<std::string>(path));
+			}
+
+		private:
+			//Copies a vector of outcomes into a managed array
+			static array<unsigned long long> ^to_array(const std::vector<qlay::Bitstring> &v)
+			{
+				array<unsigned long long> ^a = gcnew array<unsigned long long>(static_cast<int>(v.size()));
+				for (int i = 0; i < a->Length; i++)
+					a[i] = v[i];
+
+				return a;
+			}
 		};
 		
 		//Represents a qubit (quantum bit), a linear combination of |0> and |1>
@@ -99,6 +226,75 @@ namespace qlay
 			int index() { return impl_->index(); }
 		};
 
+		//Gate counts of a circuit before and after Circuit::optimise(), excluding measurements
+		public value struct OptimisationReport
+		{
+			int before;
+			int after;
+			int cancelled;
+			int merged;
+		};
+
+		//Sequence of gates and measurements recorded on qubit indices, compiled once and run many times
+		public ref class Circuit
+		{
+		internal:
+			qlay::Circuit *impl_;
+
+		public:
+			Circuit() : impl_(new qlay::Circuit())
+			{
+			}
+
+			~Circuit()
+			{
+				this->!Circuit();
+			}
+
+			!Circuit()
+			{
+				if (impl_)
+				{
+					delete impl_;
+					impl_ = nullptr;
+				}
+			}
+
+			int count() { return impl_->count(); }
+			int size() { return impl_->size(); }
+			int measurements() { return impl_->measurements(); }
+			int steps() { return impl_->steps(); }
+
+			OptimisationReport optimise()
+			{
+				qlay::OptimisationReport r = impl_->optimise();
+
+				OptimisationReport report;
+				report.before = r.before;
+				report.after = r.after;
+				report.cancelled = r.cancelled;
+				report.merged = r.merged;
+				return report;
+			}
+
+			void compile() { impl_->compile(); }
+
+			unsigned long long run(QubitSystem ^qs)
+			{
+				return impl_->run(*(qs->impl_));
+			}
+
+			array<unsigned long long> ^run(unsigned shots, Backend backend)
+			{
+				std::vector<qlay::Bitstring> v = impl_->run(shots, static_cast<qlay::Backend>(backend));
+				array<unsigned long long> ^a = gcnew array<unsigned long long>(static_cast<int>(v.size()));
+				for (int i = 0; i < a->Length; i++)
+					a[i] = v[i];
+
+				return a;
+			}
+		};
+
 
 		//Contains all quantum logic gates
 		public ref class Gates abstract sealed
@@ -114,6 +310,20 @@ namespace qlay
 				return qlay::Mx(*(q->impl_));
 			}
 
+			static unsigned long long M(QubitSystem ^qs)
+			{
+				return qlay::M(*(qs->impl_));
+			}
+
+			static unsigned long long M(QubitSystem ^qs, array<int> ^indices)
+			{
+				std::vector<int> v(indices->Length);
+				for (int i = 0; i < indices->Length; i++)
+					v[i] = indices[i];
+
+				return qlay::M(*(qs->impl_), v);
+			}
+
 			static void X(Qubit ^q)
 			{
 				qlay::X(*(q->impl_));
@@ -173,6 +383,44 @@ namespace qlay
 			{
 				qlay::CNOT(*(control->impl_), *(target->impl_));
 			}
+
+			static void depolarize(double p, Qubit ^q)
+			{
+				qlay::depolarize(p, *(q->impl_));
+			}
+
+			static void amplitude_damp(double gamma, Qubit ^q)
+			{
+				qlay::amplitude_damp(gamma, *(q->impl_));
+			}
+
+			static void phase_damp(double lambda, Qubit ^q)
+			{
+				qlay::phase_damp(lambda, *(q->impl_));
+			}
+
+			static void pauli_noise(double px, double py, double pz, Qubit ^q)
+			{
+				qlay::pauli_noise(px, py, pz, *(q->impl_));
+			}
+
+			static void M(Circuit ^c, int q) { qlay::M(*(c->impl_), q); }
+			static void Mx(Circuit ^c, int q) { qlay::Mx(*(c->impl_), q); }
+
+			static void X(Circuit ^c, int q) { qlay::X(*(c->impl_), q); }
+			static void Y(Circuit ^c, int q) { qlay::Y(*(c->impl_), q); }
+			static void Z(Circuit ^c, int q) { qlay::Z(*(c->impl_), q); }
+			static void H(Circuit ^c, int q) { qlay::H(*(c->impl_), q); }
+			static void SRNOT(Circuit ^c, int q) { qlay::SRNOT(*(c->impl_), q); }
+
+			static void Rx(double angle, Circuit ^c, int q) { qlay::Rx(angle, *(c->impl_), q); }
+			static void Ry(double angle, Circuit ^c, int q) { qlay::Ry(angle, *(c->impl_), q); }
+			static void Rz(double angle, Circuit ^c, int q) { qlay::Rz(angle, *(c->impl_), q); }
+			static void Rp(double angle, Circuit ^c, int q) { qlay::Rp(angle, *(c->impl_), q); }
+
+			static void SWAP(Circuit ^c, int a, int b) { qlay::SWAP(*(c->impl_), a, b); }
+			static void SRSWAP(Circuit ^c, int a, int b) { qlay::SRSWAP(*(c->impl_), a, b); }
+			static void CNOT(Circuit ^c, int control, int target) { qlay::CNOT(*(c->impl_), control, target); }
 		};
 	}
 }
@@ -0,0 +1,56 @@
+/**
+ * @file Backend_benchmark.cpp
+ *
+ * Compares the time and memory taken by each backend to prepare
+ * a GHZ state and evaluate a simple parity oracle on it.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Examples.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+using namespace qlay;
+
+//Prepares a GHZ state over the given qubits, then flips the phase of odd-parity states
+static void GHZ_oracle(std::vector<std::unique_ptr<Qubit>> &q)
+{
+	H(*q[0]);
+	for (std::size_t i = 1; i < q.size(); i++)
+		CNOT(*q[i-1], *q[i]);
+
+	for (std::size_t i = 0; i < q.size(); i++)
+		Z(*q[i]);
+
+	M(*q[0]);
+}
+
+void backend_benchmark(int qubits)
+{
+	init();
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	const std::pair<Backend, const char *> backends[] = {
+		{ Backend::StateVector, "StateVector:    " },
+		{ Backend::DecisionDiagram, "DecisionDiagram:" }
+	};
+
+	for (const auto &backend : backends)
+	{
+		QubitSystem qs(backend.first);
+		std::vector<std::unique_ptr<Qubit>> q;
+		for (int i = 0; i < qubits; i++)
+			q.emplace_back(new Qubit(qs));
+
+		auto start = Clock::now();
+		GHZ_oracle(q);
+		std::chrono::duration<double, std::milli> time = Clock::now() - start;
+
+		std::cout << backend.second << " " << time.count() << "ms, "
+			<< qs.report().memory / 1024 << "KiB" << std::endl;
+	}
+}
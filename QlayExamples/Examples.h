@@ -13,6 +13,7 @@
 #include "../Qlay/Qlay.h"
 
 #include <iostream>
+#include <algorithm>
 
 const unsigned DEFAULT_REPEATS = 1;
 
@@ -42,3 +43,9 @@ void DeutschJozsa_output();
 
 //Implements and demonstrates the Deutsch-Jozsa algorithm (using phase oracle)
 void DeutschJozsa_phase();
+
+//Benchmarks Qlay's random number generation against the standard library
+void RNG_benchmark(unsigned draws);
+
+//Benchmarks the dense state vector against the decision diagram backend
+void backend_benchmark(int qubits);
@@ -0,0 +1,45 @@
+/**
+ * @file RNG_benchmark.cpp
+ *
+ * Compares Qlay's bulk-buffered chance() against drawing a fresh
+ * std::bernoulli_distribution from std::default_random_engine per call.
+ *
+ * @author Sam Griffiths
+ */
+
+#include "Examples.h"
+
+#include <random>
+#include <chrono>
+
+using namespace qlay;
+
+void RNG_benchmark(unsigned draws)
+{
+	init();
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	//Previous approach: one distribution object and engine call per draw
+	std::default_random_engine engine(static_cast<unsigned>(Clock::now().time_since_epoch().count()));
+	unsigned std_hits = 0;
+
+	auto start = Clock::now();
+	for (unsigned i = 0; i < draws; i++)
+	{
+		std::bernoulli_distribution dist(0.5);
+		std_hits += dist(engine);
+	}
+	std::chrono::duration<double, std::milli> std_time = Clock::now() - start;
+
+	//Qlay: uniforms are generated in bulk by the Philox stream and consumed from a buffer
+	unsigned qlay_hits = 0;
+
+	start = Clock::now();
+	for (unsigned i = 0; i < draws; i++)
+		qlay_hits += chance(0.5);
+	std::chrono::duration<double, std::milli> qlay_time = Clock::now() - start;
+
+	std::cout << "default_random_engine: " << std_time.count() << "ms (" << std_hits << " hits)" << std::endl;
+	std::cout << "qlay::chance:          " << qlay_time.count() << "ms (" << qlay_hits << " hits)" << std::endl;
+}
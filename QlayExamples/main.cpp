@@ -19,6 +19,8 @@ int main()
 	//teleportation(1000);
 	//DeutschJozsa_output();
 	//DeutschJozsa_phase();
+	//RNG_benchmark(10000000);
+	//backend_benchmark(24);
 
 	return 0;
 }
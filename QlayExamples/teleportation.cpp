@@ -14,11 +14,9 @@ void teleportation(unsigned repeats)
 {
 	init();
 
-	int zeroes = 0, ones = 0;
-
-	for (unsigned i = 0; i < repeats; i++)
+	//Each shot is independent, so run them in parallel
+	std::vector<Basis> results = run_shots(repeats, [](QubitSystem &qs)
 	{
-		QubitSystem qs;
 		Qubit qa(qs); Qubit qb(qs); Qubit qc(qs);
 
 		//Prepare Alice's qubit with 75% chance of |1>, to teleport
@@ -46,8 +44,11 @@ void teleportation(unsigned repeats)
 		//In the latter case, correct the phase
 		if (correct_phase) Z(qb);
 
-		M(qb) ? ones++ : zeroes++;
-	}
+		return M(qb);
+	});
+
+	int ones = static_cast<int>(std::count(results.begin(), results.end(), true));
+	int zeroes = static_cast<int>(results.size()) - ones;
 
 	std::cout << "ZERO:  " << zeroes << std::endl << "ONE:   " << ones << std::endl;
 }